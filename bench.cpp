@@ -0,0 +1,722 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <vector>
+#include <algorithm>
+
+#include "tcache.h"
+#include "trace.h"
+
+// microbenchmarks of the simulator's hot paths: cache reads and writes,
+// LRU updates, map lookups, memory reads and writes and trace parsing,
+// over a range of associativities, set counts, block sizes and hit rates.
+// Each case is warmed up, run until it takes a tenth of the minimum time
+// to size its repetitions, and timed over those; the median is reported
+// as ns and accesses per second, with hardware counters per access under
+// -p. -o writes the results as JSON, one case per line, and -c compares
+// two such files, so builds can be checked for regressions.
+
+#define OFFSET 1 // 2-byte address units, as in cache_sim
+#define BENCH_ADDRS (1 << 20) // length of the precomputed access streams
+#define MAX_REPS 32
+
+static double min_time = 0.1;
+static i32 reps = 3;
+static volatile i64 bench_sink; // results of the runs, so none is optimized away
+
+// xorshift64*
+static inline i64 bench_rand(i64* s){
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545F4914F6CDD1DUL;
+}
+
+// uniformly random words of nlines lines of bvals words; an LRU cache of
+// c of the lines hits in c / nlines of them once warm
+static i64* line_stream(i64 nlines, i32 bshift, i32 bvals, i64 seed){
+  i64* a = new i64[BENCH_ADDRS];
+  i64 s = seed * 0x9E3779B97F4A7C15UL + 1;
+  for (i32 i = 0;i < BENCH_ADDRS;i++){
+    i64 r = bench_rand(&s);
+    a[i] = ((r % nlines) << bshift) + (((r >> 40) % bvals) << 2);
+  }
+  return a;
+}
+
+static const char* size_name(i64 bytes, char* buf){
+  if (bytes >= (1 << 20)){
+    sprintf(buf, "%luM", bytes >> 20);
+  }else{
+    sprintf(buf, "%luK", bytes >> 10);
+  }
+  return buf;
+}
+
+class bench_case {
+ protected:
+  i64 pos; // next entry of the access stream; runs carry on from each other
+ public:
+  char name[160];
+  bench_case(){
+    name[0] = '\0';
+    pos = 0;
+  }
+  virtual ~bench_case(){}
+  // bring the case to its steady state
+  virtual void warm(){
+    bench_sink += run(2 * BENCH_ADDRS);
+  }
+  // n operations
+  virtual i64 run(i64 n) = 0;
+  // accesses and hits so far, both 0 if the case has no hit rate
+  virtual void counts(i64* accs, i64* hits){
+    *accs = *hits = 0;
+  }
+};
+
+// one cache level backed by a memory of its own, with the map disabled
+template <i32 DATA>
+class cache_case : public bench_case {
+  tcache_t<DATA>* c;
+  tmemory* mem;
+  mem_map* map;
+  i64* addrs;
+  i32 wr;
+ public:
+  cache_case(i32 write, i32 assoc, i32 sets, i32 bsize, i32 hit){
+    wr = write;
+    c = new tcache_t<DATA>(sets, bsize, assoc, OFFSET);
+    c->set_name((char*) "L1");
+    mem = new tmemory(OFFSET);
+    c->set_mem(mem);
+    map = new mem_map(0, 4096, bsize, 32, OFFSET);
+    c->set_map(map);
+    addrs = line_stream((i64) sets * assoc * 100 / hit, tcache_t<DATA>::block_shift(bsize, OFFSET), bsize >> 3,
+			assoc * 7919 + sets * 31 + bsize);
+  }
+  ~cache_case(){
+    delete c;
+    delete map;
+    delete mem;
+    delete[] addrs;
+  }
+  i64 run(i64 n){
+    i64 sum = 0;
+    if (wr){
+      for (i64 i = pos;i < pos + n;i++){
+	i64 a = addrs[i & (BENCH_ADDRS - 1)];
+	c->write(a, a | 1);
+      }
+    }else{
+      for (i64 i = pos;i < pos + n;i++){
+	sum += c->read(addrs[i & (BENCH_ADDRS - 1)], 0);
+      }
+    }
+    pos += n;
+    return sum;
+  }
+  void counts(i64* accs, i64* hits){
+    *accs = c->get_accs();
+    *hits = c->get_hits();
+  }
+};
+
+// LRU updates of random ways of 1024 sets
+class lru_case : public bench_case {
+  tcache* c;
+  cache_set* sets;
+  i32* picks; // set, and way above bit 10
+ public:
+  lru_case(i32 assoc){
+    c = new tcache(1024, 64, assoc, OFFSET);
+    sets = new cache_set[1024];
+    lru_age* ages = new lru_age[1024 * assoc];
+    for (i32 i = 0;i < 1024;i++){
+      sets[i].age = ages + i * assoc;
+      lru_init(sets[i].age, assoc);
+    }
+    picks = new i32[BENCH_ADDRS];
+    i64 s = assoc;
+    for (i32 i = 0;i < BENCH_ADDRS;i++){
+      i64 r = bench_rand(&s);
+      picks[i] = (r & 1023) | (((r >> 32) % assoc) << 10);
+    }
+  }
+  ~lru_case(){
+    delete c;
+    delete[] sets[0].age;
+    delete[] sets;
+    delete[] picks;
+  }
+  i64 run(i64 n){
+    for (i64 i = pos;i < pos + n;i++){
+      i32 p = picks[i & (BENCH_ADDRS - 1)];
+      c->update_lru(&(sets[p & 1023]), p >> 10, 1);
+    }
+    pos += n;
+    return sets[0].age[0];
+  }
+};
+
+// lookups of random words of an enabled map, 4 KB pages; the hit rate is
+// that of the first TLB
+class map_case : public bench_case {
+  mem_map* m;
+  i64* addrs;
+ public:
+  map_case(i32 ents, i32 assoc, i32 hit){
+    m = new mem_map(1, 4096, 64, ents, OFFSET, assoc);
+    addrs = line_stream((i64) ents * 100 / hit, 12 - OFFSET, 512, ents * 31 + assoc);
+  }
+  ~map_case(){
+    delete m;
+    delete[] addrs;
+  }
+  i64 run(i64 n){
+    i64 sum = 0;
+    for (i64 i = pos;i < pos + n;i++){
+      sum += m->lookup(addrs[i & (BENCH_ADDRS - 1)]);
+    }
+    pos += n;
+    return sum;
+  }
+  void counts(i64* accs, i64* hits){
+    *accs = m->get_tlb()->accs;
+    *hits = m->get_tlb()->hits;
+  }
+};
+
+// random words of a footprint of memory, all of it written beforehand
+class mem_case : public bench_case {
+  tmemory* m;
+  i64* addrs;
+  i64 words;
+  i32 wr;
+ public:
+  mem_case(i32 write, i64 bytes){
+    wr = write;
+    words = bytes >> 3;
+    m = new tmemory(OFFSET);
+    addrs = line_stream(words, 2, 1, words);
+  }
+  ~mem_case(){
+    delete m;
+    delete[] addrs;
+  }
+  void warm(){
+    for (i64 w = 0;w < words;w++){
+      m->write(w << 2, w | 1);
+    }
+    bench_sink += run(BENCH_ADDRS);
+  }
+  i64 run(i64 n){
+    i64 sum = 0;
+    if (wr){
+      for (i64 i = pos;i < pos + n;i++){
+	i64 a = addrs[i & (BENCH_ADDRS - 1)];
+	m->write(a, a | 1);
+      }
+    }else{
+      for (i64 i = pos;i < pos + n;i++){
+	sum += m->read(addrs[i & (BENCH_ADDRS - 1)]);
+      }
+    }
+    pos += n;
+    return sum;
+  }
+};
+
+// text trace lines, with zero values or full 64-bit ones
+class parse_case : public bench_case {
+  char* text;
+  char* end;
+ public:
+  parse_case(i32 full){
+    // 64K lines of at most 48 bytes, and the 16 readable bytes past the
+    // last one that trace_parse needs
+    text = new char[(64 << 10) * 48 + 16]();
+    end = text;
+    i64 s = 1 + full;
+    for (i32 i = 0;i < (64 << 10);i++){
+      i64 r = bench_rand(&s);
+      i64 v = full ? bench_rand(&s) : 0;
+      end += sprintf(end, "%s %lx %lx\n", (r & 3) ? "read" : "write", 0x7f0000000000UL + ((r >> 20) << 2), v);
+    }
+  }
+  ~parse_case(){
+    delete[] text;
+  }
+  i64 run(i64 n){
+    const char* p = text + pos;
+    i64 sum = 0;
+    trace_rec r;
+    for (i64 i = 0;i < n;i++){
+      if (p == end){
+	p = text;
+      }
+      sum += trace_parse(p, &p, &r) + r.value;
+    }
+    pos = p - text;
+    return sum;
+  }
+};
+
+// hardware counters of this thread in user mode, read as one group
+
+#define BENCH_NCTRS 4
+
+static const char* ctr_names[] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+static const i64 ctr_events[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+				  PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+class perf_counters {
+  int fd[BENCH_NCTRS];
+ public:
+  perf_counters(){
+    for (i32 i = 0;i < BENCH_NCTRS;i++){
+      fd[i] = -1;
+    }
+  }
+  // 0, with a message, if the kernel gives us no counters
+  i32 open(){
+    for (i32 i = 0;i < BENCH_NCTRS;i++){
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = ctr_events[i];
+      attr.disabled = (i == 0);
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : fd[0], 0);
+      if (fd[i] < 0){
+	fprintf(stderr, "No %s counter (%s), running without counters\n", ctr_names[i], strerror(errno));
+	for (i32 j = 0;j < i;j++){
+	  close(fd[j]);
+	}
+	return 0;
+      }
+    }
+    return 1;
+  }
+  void start(){
+    ioctl(fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  // add what the counters counted since start to out
+  void stop(i64* out){
+    i64 buf[BENCH_NCTRS + 1];
+    ioctl(fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(fd[0], buf, sizeof(buf)) == (ssize_t) sizeof(buf)){
+      for (i32 i = 0;i < BENCH_NCTRS;i++){
+	out[i] += buf[i + 1];
+      }
+    }
+  }
+};
+
+typedef struct bench_result_t {
+  char name[160];
+  i64 iters; // operations per repetition
+  double ns; // per operation, median of the repetitions
+  double ns_min;
+  double hit; // negative if the case has no hit rate
+  double ctr[BENCH_NCTRS]; // per operation, if counted
+} bench_result;
+
+static void measure(bench_case* bc, perf_counters* pc, bench_result* r){
+  double ns[MAX_REPS], t, t0;
+  i64 n = 1024, a0, h0, a1, h1;
+  i64 ctr[BENCH_NCTRS] = { 0 };
+
+  bc->warm();
+  for (;;){
+    t0 = wtime();
+    bench_sink += bc->run(n);
+    t = wtime() - t0;
+    if (t >= min_time / 10 || n >= (1UL << 40)){
+      break;
+    }
+    n *= 8;
+  }
+  n = (t > 0) ? (i64) (n * (min_time / t)) : n;
+  n = (n == 0) ? 1 : n;
+
+  bc->counts(&a0, &h0);
+  for (i32 i = 0;i < reps;i++){
+    if (pc != 0){
+      pc->start();
+    }
+    t0 = wtime();
+    bench_sink += bc->run(n);
+    t = wtime() - t0;
+    if (pc != 0){
+      pc->stop(ctr);
+    }
+    ns[i] = t * 1e9 / n;
+  }
+  bc->counts(&a1, &h1);
+
+  std::sort(ns, ns + reps);
+  snprintf(r->name, sizeof(r->name), "%s", bc->name);
+  r->iters = n;
+  r->ns = (reps & 1) ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2;
+  r->ns_min = ns[0];
+  r->hit = (a1 > a0) ? (double) (h1 - h0) / (a1 - a0) : -1.0;
+  for (i32 i = 0;i < BENCH_NCTRS;i++){
+    r->ctr[i] = (pc != 0) ? (double) ctr[i] / ((double) n * reps) : -1.0;
+  }
+}
+
+// the cases: each cache sweep varies one of associativity, sets, block
+// size and hit rate around an 8-way, 1024 set, 64 B level that hits 90%
+
+#define BK_READ 0
+#define BK_WRITE 1
+#define BK_TAG_READ 2
+#define BK_LRU 3
+#define BK_MAP 4
+#define BK_MEM_READ 5
+#define BK_MEM_WRITE 6
+#define BK_PARSE 7
+
+typedef struct bench_spec_t {
+  i32 kind;
+  i32 p[4];
+} bench_spec;
+
+static void add_spec(std::vector<bench_spec>* v, i32 kind, i32 a, i32 b = 0, i32 c = 0, i32 d = 0){
+  bench_spec s = { kind, { a, b, c, d } };
+  for (size_t i = 0;i < v->size();i++){
+    if ((*v)[i].kind == kind && memcmp((*v)[i].p, s.p, sizeof(s.p)) == 0){
+      return;
+    }
+  }
+  v->push_back(s);
+}
+
+static void make_specs(std::vector<bench_spec>* v){
+  static const i32 assocs[] = { 1, 2, 4, 8, 16, 32, 64 };
+  static const i32 sets[] = { 64, 256, 1024, 4096, 16384 };
+  static const i32 bsizes[] = { 32, 64, 128, 256 };
+  static const i32 hits[] = { 100, 90, 50, 10 };
+  static const i32 footprints[] = { 64, 4096, 65536 }; // KB
+  static const i32 kinds[] = { BK_READ, BK_WRITE, BK_TAG_READ };
+
+  for (i32 k = 0;k < 3;k++){
+    for (i32 i = 0;i < 7;i++){
+      add_spec(v, kinds[k], assocs[i], 1024, 64, 90);
+    }
+    for (i32 i = 0;i < 5;i++){
+      add_spec(v, kinds[k], 8, sets[i], 64, 90);
+    }
+    for (i32 i = 0;i < 4;i++){
+      add_spec(v, kinds[k], 8, 1024, bsizes[i], 90);
+    }
+    for (i32 i = 0;i < 4;i++){
+      add_spec(v, kinds[k], 8, 1024, 64, hits[i]);
+    }
+  }
+  for (i32 i = 1;i < 7;i++){
+    add_spec(v, BK_LRU, assocs[i]);
+  }
+  add_spec(v, BK_MAP, 16, 0, 90);
+  add_spec(v, BK_MAP, 64, 0, 90);
+  add_spec(v, BK_MAP, 512, 0, 90);
+  add_spec(v, BK_MAP, 64, 4, 90);
+  for (i32 i = 0;i < 4;i++){
+    add_spec(v, BK_MAP, 64, 0, hits[i]);
+  }
+  for (i32 i = 0;i < 3;i++){
+    add_spec(v, BK_MEM_READ, footprints[i]);
+    add_spec(v, BK_MEM_WRITE, footprints[i]);
+  }
+  add_spec(v, BK_PARSE, 0);
+  add_spec(v, BK_PARSE, 1);
+}
+
+// the name of the case a spec makes, known before the case is made
+static void spec_name(const bench_spec* s, char* name, i32 len){
+  const i32* p = s->p;
+  char buf[32];
+  switch (s->kind){
+  case BK_READ:
+  case BK_WRITE:
+  case BK_TAG_READ:
+    snprintf(name, len, "%s_%s/assoc:%u/sets:%u/bsize:%u/hit:%u", (s->kind == BK_TAG_READ) ? "tag_cache" : "tcache",
+	     (s->kind == BK_WRITE) ? "write" : "read", p[0], p[1], p[2], p[3]);
+    break;
+  case BK_LRU:
+    snprintf(name, len, "tcache_update_lru/assoc:%u", p[0]);
+    break;
+  case BK_MAP:
+    snprintf(name, len, "mem_map_lookup/tlb:%u/ways:%u/hit:%u", p[0], p[1] ? p[1] : p[0], p[2]);
+    break;
+  case BK_MEM_READ:
+  case BK_MEM_WRITE:
+    snprintf(name, len, "tmemory_%s/footprint:%s", (s->kind == BK_MEM_WRITE) ? "write" : "read",
+	     size_name((i64) p[0] << 10, buf));
+    break;
+  default:
+    snprintf(name, len, "trace_parse/values:%s", p[0] ? "full" : "zero");
+  }
+}
+
+static bench_case* make_case(const bench_spec* s){
+  const i32* p = s->p;
+  bench_case* bc;
+  switch (s->kind){
+  case BK_READ:
+    bc = new cache_case<1>(0, p[0], p[1], p[2], p[3]);
+    break;
+  case BK_WRITE:
+    bc = new cache_case<1>(1, p[0], p[1], p[2], p[3]);
+    break;
+  case BK_TAG_READ:
+    bc = new cache_case<0>(0, p[0], p[1], p[2], p[3]);
+    break;
+  case BK_LRU:
+    bc = new lru_case(p[0]);
+    break;
+  case BK_MAP:
+    bc = new map_case(p[0], p[1], p[2]);
+    break;
+  case BK_MEM_READ:
+  case BK_MEM_WRITE:
+    bc = new mem_case(s->kind == BK_MEM_WRITE, (i64) p[0] << 10);
+    break;
+  default:
+    bc = new parse_case(p[0]);
+  }
+  spec_name(s, bc->name, sizeof(bc->name));
+  return bc;
+}
+
+static void print_header(i32 ctrs){
+  printf("%-52s %10s %12s %8s %12s", "Benchmark", "ns/access", "accesses/s", "hit rate", "iterations");
+  if (ctrs){
+    printf(" %10s %8s %10s %10s", "cycles", "IPC", "LLC miss", "br miss");
+  }
+  printf("\n");
+}
+
+static void print_result(const bench_result* r){
+  char hit[16];
+  snprintf(hit, sizeof(hit), (r->hit < 0) ? "-" : "%.4f", r->hit);
+  printf("%-52s %10.2f %12.0f %8s %12lu", r->name, r->ns, 1e9 / r->ns, hit, r->iters);
+  if (r->ctr[0] >= 0){
+    printf(" %10.2f %8.2f %10.4f %10.4f", r->ctr[0], (r->ctr[0] > 0) ? r->ctr[1] / r->ctr[0] : 0.0,
+	   r->ctr[2], r->ctr[3]);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+static i32 write_json(const char* file, const std::vector<bench_result>& res){
+  FILE* fp = fopen(file, "w");
+  char host[256] = "";
+  char date[64];
+  time_t now = time(0);
+
+  if (fp == NULL){
+    perror(file);
+    return 0;
+  }
+  gethostname(host, sizeof(host) - 1);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+  fprintf(fp, "{\n  \"context\": {\"date\": \"%s\", \"host\": \"%s\", \"cpus\": %ld, ", date, host,
+	  sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef __AVX2__
+  fprintf(fp, "\"simd\": \"avx2\", ");
+#else
+  fprintf(fp, "\"simd\": \"sse2\", ");
+#endif
+  fprintf(fp, "\"min_time\": %g, \"repetitions\": %u},\n  \"benchmarks\": [\n", min_time, reps);
+  for (size_t i = 0;i < res.size();i++){
+    const bench_result* r = &(res[i]);
+    fprintf(fp, "    {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_access\": %.4f, \"ns_min\": %.4f, "
+	    "\"accesses_per_s\": %.0f", r->name, r->iters, r->ns, r->ns_min, 1e9 / r->ns);
+    if (r->hit >= 0){
+      fprintf(fp, ", \"hit_rate\": %.6f", r->hit);
+    }
+    for (i32 j = 0;j < BENCH_NCTRS && r->ctr[0] >= 0;j++){
+      fprintf(fp, ", \"%s\": %.4f", ctr_names[j], r->ctr[j]);
+    }
+    fprintf(fp, "}%s\n", (i + 1 < res.size()) ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+  return 1;
+}
+
+// name and ns_per_access of every case in a file write_json wrote
+static i32 read_json(const char* file, std::vector<bench_result>* res){
+  FILE* fp = fopen(file, "r");
+  char line[1024];
+
+  if (fp == NULL){
+    perror(file);
+    return 0;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL){
+    char* p = strstr(line, "\"name\": \"");
+    char* q = strstr(line, "\"ns_per_access\": ");
+    if (p == NULL || q == NULL){
+      continue;
+    }
+    bench_result r;
+    memset(&r, 0, sizeof(r));
+    p += strlen("\"name\": \"");
+    size_t len = strcspn(p, "\"");
+    len = (len < sizeof(r.name)) ? len : sizeof(r.name) - 1;
+    memcpy(r.name, p, len);
+    r.ns = atof(q + strlen("\"ns_per_access\": "));
+    res->push_back(r);
+  }
+  fclose(fp);
+  return 1;
+}
+
+// the change of every case in both files, returns how many got slower by
+// more than threshold percent
+static i32 compare(const char* base, const char* cur, double threshold){
+  std::vector<bench_result> b, c;
+  i32 slower = 0, faster = 0, missing = 0;
+
+  if (read_json(base, &b) == 0 || read_json(cur, &c) == 0){
+    return -1;
+  }
+  printf("%-52s %10s %10s %8s\n", "Benchmark", "base ns", "ns", "change");
+  for (size_t i = 0;i < c.size();i++){
+    size_t j;
+    for (j = 0;j < b.size() && strcmp(b[j].name, c[i].name) != 0;j++);
+    if (j == b.size()){
+      missing++;
+      continue;
+    }
+    double d = (b[j].ns > 0) ? (c[i].ns - b[j].ns) / b[j].ns * 100.0 : 0.0;
+    const char* mark = "";
+    if (d > threshold){
+      mark = "  slower";
+      slower++;
+    }else if (d < -threshold){
+      mark = "  faster";
+      faster++;
+    }
+    printf("%-52s %10.2f %10.2f %+7.1f%%%s\n", c[i].name, b[j].ns, c[i].ns, d, mark);
+  }
+  printf("%u slower, %u faster by more than %g%%", slower, faster, threshold);
+  if (missing != 0){
+    printf(", %u not in %s", missing, base);
+  }
+  printf("\n");
+  return slower;
+}
+
+static void usage(const char* prog){
+  printf("usage: %s [-t secs] [-r reps] [-f filter] [-p] [-l] [-o out.json]\n", prog);
+  printf("       %s -c base.json new.json [-x percent]\n", prog);
+  printf("  -t secs    minimum time of each repetition (0.1)\n");
+  printf("  -r reps    repetitions of each case, the median is reported (3)\n");
+  printf("  -f filter  only the cases whose name contains filter\n");
+  printf("  -p         hardware counters per access, through perf_event_open\n");
+  printf("  -l         list the cases\n");
+  printf("  -o file    write the results as JSON\n");
+  printf("  -c         compare two results files, exit status 1 if a case is\n");
+  printf("             slower by more than -x percent (5)\n");
+}
+
+int main(int argc, char** argv){
+  const char* filter = 0;
+  const char* out = 0;
+  i32 counters = 0, list = 0, cmp = 0;
+  double threshold = 5.0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:r:f:plo:cx:")) != -1){
+    switch (opt){
+    case 't':
+      min_time = atof(optarg);
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'p':
+      counters = 1;
+      break;
+    case 'l':
+      list = 1;
+      break;
+    case 'o':
+      out = optarg;
+      break;
+    case 'c':
+      cmp = 1;
+      break;
+    case 'x':
+      threshold = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (cmp){
+    if (argc - optind != 2){
+      usage(argv[0]);
+      return 1;
+    }
+    i32 slower = compare(argv[optind], argv[optind + 1], threshold);
+    return (slower != 0) ? 1 : 0;
+  }
+  if (argc != optind || min_time <= 0.0 || reps == 0 || reps > MAX_REPS){
+    usage(argv[0]);
+    return 1;
+  }
+
+  perf_counters pc;
+  perf_counters* pcp = (counters && pc.open()) ? &pc : 0;
+  std::vector<bench_spec> specs;
+  std::vector<bench_result> res;
+  char name[160];
+
+  make_specs(&specs);
+  if (!list){
+    print_header(pcp != 0);
+  }
+  // cases are only made, one at a time, once they pass the filter
+  for (size_t i = 0;i < specs.size();i++){
+    spec_name(&(specs[i]), name, sizeof(name));
+    if (filter != 0 && strstr(name, filter) == 0){
+      continue;
+    }
+    if (list){
+      printf("%s\n", name);
+      continue;
+    }
+    bench_case* bc = make_case(&(specs[i]));
+    bench_result r;
+    measure(bc, pcp, &r);
+    print_result(&r);
+    res.push_back(r);
+    delete bc;
+  }
+  if (out != 0 && !list){
+    if (write_json(out, res) == 0){
+      return 1;
+    }
+    fprintf(stderr, "Wrote %lu results to %s\n", res.size(), out);
+  }
+  return 0;
+}
@@ -7,21 +7,38 @@
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <thread>
 
 #include "store.h"
 #include "tcache.h"
 #include "memmap.h"
+#include "trace.h"
+#include "hier.h"
+#include "stackdist.h"
+#include "synth.h"
 
 using namespace std;
 
 #define OFFSET 1
 #define RANGE 1 << 16
 
-FILE *tlog;
-
-//#define TEST 1
-
-FILE * l2trace;
+// refill value trace output: compression, and values or bytes per file
+static i32 vs_comp = VS_NONE;
+static i64 vs_recs = (LMAX);
+static i64 vs_bytes = 0;
+// interval statistics: accesses per sample, 0 for none, and JSON lines
+// instead of CSV
+static i64 st_interval = 0;
+static i32 st_json = 0;
+// observers: the taint log and the refill value trace unless turned off,
+// per-set counters and one watched address on request
+static i32 obs_taint = 1;
+static i32 obs_values = 1;
+static i32 obs_sets = 0;
+static i32 obs_watch = 0;
+static i64 watch_addr = 0;
+// -G: synthetic accesses instead of trace files
+static synth_gen* synth = 0;
 
 int bin2dec(char *bin)   
 {
@@ -48,230 +65,623 @@ int bin2dec(char *bin)
   return(sum);
 }
 
-int main(int argc, char** argv){
-  unsigned int lines = 0;
-  unsigned long mismatches = 0;
-  if (argc != 7){
-    printf( "usage: %s (associativity) (sets) (bsize) (skip) (dir) filename\n", argv[0]);
-  }else{
-    unsigned int sets, bsize, assoc, addr, zero, isRead;
-    unsigned long long value, sval;
-    unsigned int skip;
+void usage(char* prog){
+  printf("usage: %s [-T] [-D] (associativity) (sets) (bsize) (skip) (dir) filename\n", prog);
+  printf("       %s [-T] [-D] -c config | -H spec | -S sweep ... (skip) (dir) filename\n", prog);
+  printf("  -c config  cache hierarchy file: \"level name assoc sets bsize [lru|fifo|random]\"\n");
+  printf("             lines from L1 down, and an optional \"map enable psize entries\n");
+  printf("             [assoc [l2-entries [l2-assoc]]]\" line (fully associative L1 TLB\n");
+  printf("             and a 4x L2 TLB by default)\n");
+  printf("  -H spec    cache hierarchy as name:assoc:sets:bsize[:policy],... from L1 down\n");
+  printf("  -S sweep   file of -H specs, one per line\n");
+  printf("  -c, -H and -S may be repeated; every hierarchy is simulated on its own\n");
+  printf("  thread from a single decode of the trace\n");
+  printf("  -T         tag-only caches: counts only, no values stored or checked\n");
+  printf("  -D         merge memory pages with identical contents as they pile up\n");
+  printf("  -z comp    compress the values read from memory, <app>_l2trace<N>.vtr:\n");
+  printf("             none, gz or zst (with ZSTD=1)\n");
+  printf("  -R values  start a new value trace file after this many values\n");
+  printf("  -B MB      or once a file has grown to this size\n");
+  printf("  -i n       write every level's and the map's counters each n accesses\n");
+  printf("             to <app>-stats.csv\n");
+  printf("  -j         as JSON lines, <app>-stats.json\n");
+  printf("  -O list    observers, comma separated: taint (hit levels, <app>-taint.evl),\n");
+  printf("             values (refill values) and sets (per-set counts), or none;\n");
+  printf("             taint,values by default\n");
+  printf("  -W addr    print every event of the lines holding hex address addr\n");
+  printf("  -G spec    simulate synthetic accesses instead of the traces in (dir):\n");
+  printf("             kind[:key=value...],... with kinds seq, stride, random, zipf\n");
+  printf("             and chase, keys n, size, stride, theta, w (%% writes), z (%% zero\n");
+  printf("             words), base and seed; filename only names the output files\n");
+  printf("       %s -m bsize [-f assoc:sets] [-r rate] (skip) (dir) filename\n", prog);
+  printf("  -m bsize   LRU miss ratio curve for every size and associativity\n");
+  printf("  -f spec    curve of the misses of an L1 of the given geometry\n");
+  printf("  -r rate    sample blocks and sets at this rate, 0 < rate <= 1\n");
+}
 
-    // read input arguments
-    assoc = atoi(argv[1]);
-    sets = atoi(argv[2]);
-    bsize = atoi(argv[3]);
-    skip = atoi(argv[4]) * 1000000;
-
-    // initialize cache and local variables;
-    tcache* dl1 = new tcache(32, bsize, 2, OFFSET);
-    tcache* dl2 = new tcache(sets, bsize, assoc, OFFSET);
-    mem_map* mp = new mem_map(0, 4096, bsize, 32, OFFSET); // added enable (0-off,1-on)
-    tmemory* sp = new tmemory(OFFSET);
-    FILE *in;
-    
-    dl1->set_nl(dl2);
-    dl2->set_mem(sp);
-    dl2->set_map(mp);
-    dl1->set_name("L1");
-    dl2->set_name("L2");
-#ifdef REFILL
-    dl2->set_trace(argv[6]);
-#endif
-    // single file trace implementation
-    //FILE *in = fopen (argv[6], "r");
-
-    // socket connection implementation
-    // setup the socket connection
-    /* int s, ns, len;
-    struct sockaddr_un sock;
-    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-      perror("socket");
-      exit(1);
+// number of trace files <dir>/<app>0.. present, 0 if there are none
+static i32 count_traces(const char* dir, const char* app){
+  i32 fcnt = 0;
+  DIR *dp;
+  char file[512];
+  if((dp  = opendir(dir)) == NULL) {
+      cout << "Error(" << errno << ") opening " << dir << endl;
+      return 0;
+  }
+  closedir(dp);
+  while (trace_find(file, dir, app, fcnt)){
+    fcnt++;
+  }
+  if (fcnt == 0){
+    fprintf(stderr, "No valid trace files of name %s found\n", app);
+  }
+  return fcnt;
+}
+
+// a feeder for the trace files of app in dir, or for the synthetic
+// accesses of -G; 0 if there is nothing to read
+static trace_feeder* open_feed(const char* dir, const char* app, i32 nreaders){
+  if (synth != 0){
+    return new trace_feeder(synth, nreaders);
+  }
+  i32 fcnt = count_traces(dir, app);
+  if (fcnt == 0){
+    return 0;
+  }
+  return new trace_feeder(dir, app, fcnt, nreaders);
+}
+
+// stack distance pass over the raw references, or over the references an
+// L1 misses on when filter is given
+static i32 run_mrc(i32 bsize, const char* filter, double rate, i64 skip, char* dir, char* app){
+  i32 fassoc = 0, fsets = 0;
+  tag_cache* l1 = 0;
+  trace_batch* batch;
+  i64 lines = 0;
+
+  if (!pow2(bsize) || bsize < 8){
+    fprintf(stderr, "Invalid block size %u\n", bsize);
+    return 1;
+  }
+  if (rate <= 0.0 || rate > 1.0){
+    fprintf(stderr, "Sampling rate must be in (0, 1]\n");
+    return 1;
+  }
+  if (filter != 0){
+    if (sscanf(filter, "%u:%u", &fassoc, &fsets) != 2 || !pow2(fsets) ||
+	fassoc == 0 || fassoc > MAX_ASSOC || bsize > 512){
+      fprintf(stderr, "Invalid L1 filter %s, expected assoc:sets\n", filter);
+      return 1;
     }
+    l1 = new tag_cache(fsets, bsize, fassoc, OFFSET);
+    l1->set_name(strdup("L1"));
+    l1->set_mem(new tmemory(OFFSET));
+    l1->set_map(new mem_map(0, 4096, bsize, 32, OFFSET));
+  }
 
-    sock.sun_family = AF_UNIX;
-    strcpy(sock.sun_path, argv[6]);
-    len = strlen(sock.sun_path) + sizeof(sock.sun_family);
+  trace_feeder* feed = open_feed(dir, app, 1);
+  if (feed == 0){
+    return 1;
+  }
 
-    if (bind(s, (sockaddr*)&sock, len) == -1){
-      perror("bind");
-      exit(1);
+  stack_dist* sd = new stack_dist(bsize, OFFSET, rate);
+  feed->start();
+
+  while ((batch = feed->next()) != 0) {
+    for (i32 b = 0;b < batch->n;b++){
+      const trace_rec* rp = &(batch->recs[b]);
+      if (l1 != 0){
+	i64 misses = l1->get_accs() - l1->get_hits();
+	if (rp->op == TR_WRITE){
+	  l1->write(rp->addr, rp->value);
+	}else{
+	  l1->read(rp->addr, 0);
+	}
+	if (l1->get_accs() - l1->get_hits() != misses){
+	  sd->access(rp->addr);
+	}
+      }else{
+	sd->access(rp->addr);
+      }
+      if (++lines == skip){
+	sd->clearstats();
+      }
     }
-    printf("Attempting to listen on socket %d\n", s);
-    listen(s, 5);
-    printf("Waiting for connection on socket %d\n", s);
-    if ((ns = accept(s, 0, 0)) == -1){
-      perror("accept");
-      exit(1);
+    feed->release();
+  }
+  feed->join();
+
+  const trace_stats* ts = feed->get_stats();
+  printf("Trace decode: %lu lines, %lu malformed, %.0f lines/s\n", ts->lines, ts->bad,
+	 (ts->dtime > ts->iotime) ? ts->lines / (ts->dtime - ts->iotime) : 0.0);
+  if (l1 != 0){
+    printf("Filtered through a %u-way %u-set L1\n", fassoc, fsets);
+  }
+  sd->stats();
+  printf("Simulation complete after %lu accesses\n", lines);
+  printf("Peak RSS: %lu KB\n", peak_rss());
+  i32 failed = ts->failed;
+  delete feed;
+  return (failed == 0) ? 0 : 1;
+}
+
+// -O list: comma separated observer names, "none" turns all off
+static i32 parse_observers(const char* list){
+  char buf[256];
+  char* save;
+
+  snprintf(buf, sizeof(buf), "%s", list);
+  obs_taint = obs_values = obs_sets = 0;
+  for (char* s = strtok_r(buf, ",", &save);s != 0;s = strtok_r(0, ",", &save)){
+    if (strcmp(s, "taint") == 0){
+      obs_taint = 1;
+    }else if (strcmp(s, "values") == 0){
+      obs_values = 1;
+    }else if (strcmp(s, "sets") == 0){
+      obs_sets = 1;
+    }else if (strcmp(s, "none") != 0){
+      fprintf(stderr, "Unknown observer %s\n", s);
+      return 0;
     }
-    printf("Connected!!\n\n");*/
+  }
+  return 1;
+}
 
-#ifdef LOG
-  char tf[512];
-  //sprintf(tf, "%s/%s-taint.log", argv[8], argv[9]);
-  sprintf(tf, "%s-taint.log", argv[6]);
-  tlog = fopen(tf, "w");
-  fprintf(stderr, "Writing accesses to file %s\n", tf);
-  if (tlog == NULL){
-    perror("Invalid file");
+// a hierarchy without observers has nothing to set up
+template <i32 DATA>
+static void observe(hierarchy_t<DATA, no_observer>* /*hp*/, const char* /*tag*/){
+}
+
+// open the outputs of the observers asked for, tagged like the rest of
+// the hierarchy's files
+template <i32 DATA>
+static void observe(hierarchy_t<DATA, sim_observer>* hp, const char* tag){
+  sim_observer* op = hp->observer();
+
+  if (DATA && obs_values){
+    op->open_trace(tag, vs_comp, vs_recs, vs_bytes);
   }
-#endif   
+  if (obs_taint){
+    char tf[512];
+    snprintf(tf, sizeof(tf), "%s-taint.evl", tag);
+    fprintf(stderr, "Writing accesses to file %s\n", tf);
+    if (op->open_log(tf) == 0){
+      perror("Invalid file");
+    }
+  }
+  if (obs_sets){
+    op->track_sets();
+  }
+  if (obs_watch){
+    op->watch(watch_addr);
+  }
+}
 
-#ifndef REGRESS
+// simulate every batch of the trace on one hierarchy
+template <i32 DATA, class OBS>
+static void simulate(trace_feeder* feed, hierarchy_t<DATA, OBS>* hp, i32 reader){
+  trace_batch* batch;
+
+  while ((batch = feed->next(reader)) != 0) {
+    for (i32 b = 0;b < batch->n;b++){
+      hp->access(&(batch->recs[b]));
+    }
+    feed->release(reader);
+  }
+}
+
+// reads that found a nonzero word other than the trace's nonzero value
+// rewrite it, which a tag-only run cannot see, so its counters then differ
+static void conflict_note(i32 data, i64 conflicts){
+  if (data){
+    printf("%lu value conflicts encountered\n", conflicts);
+  }else{
+    printf("Value conflicts are not seen without data; the counters are approximate if a data run reports any\n");
+  }
+}
 
-    unsigned int fcnt = 0;
-    DIR *dp;
-    struct dirent *dirp;
-    if((dp  = opendir(argv[5])) == NULL) {
-        cout << "Error(" << errno << ") opening " << argv[5] << endl;
-        return errno;
+// build, run and report one hierarchy per configuration; lines counts the
+// first one's accesses, mismatches and conflicts the last one's. Returns 0
+// if a trace file could not be read to its end or an output not written.
+template <i32 DATA, class OBS>
+static i32 run(hier_cfg* cfgs, i32 ncfgs, i64 skip, char* dir, char* app, i64* lines, i64* mismatches, i64* conflicts){
+  // initialize caches and local variables; when sweeping, each
+  // hierarchy's output files are tagged with its position
+  hierarchy_t<DATA, OBS>** hps = new hierarchy_t<DATA, OBS>*[ncfgs];
+  char** tags = new char*[ncfgs];
+  for (i32 k = 0;k < ncfgs;k++){
+    hps[k] = new hierarchy_t<DATA, OBS>(&(cfgs[k]), OFFSET);
+    hps[k]->set_skip(skip);
+    tags[k] = (char *)malloc(512 * sizeof(char));
+    if (ncfgs > 1){
+      snprintf(tags[k], 512, "%s-cfg%u", app, k);
+    }else{
+      snprintf(tags[k], 512, "%s", app);
     }
-    while ((dirp = readdir(dp)) != NULL) {
-      if ((strstr(dirp->d_name, argv[6]) != NULL) && (strstr(dirp->d_name, "log") != NULL)){
-	fcnt++;
+    observe<DATA>(hps[k], tags[k]);
+    if (st_interval != 0){
+      char sf[512];
+      snprintf(sf, sizeof(sf), "%s-stats.%s", tags[k], st_json ? "json" : "csv");
+      if (hps[k]->set_stats(sf, st_interval, st_json) == 0){
+	perror(sf);
       }
     }
-    closedir(dp);
+  }
+  hierarchy_t<DATA, OBS>* hp = hps[0];
+  i32 ok = 1;
+  // single file trace implementation
+  //FILE *in = fopen (argv[6], "r");
+
+  // socket connection implementation
+  // setup the socket connection
+  /* int s, ns, len;
+  struct sockaddr_un sock;
+  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    perror("socket");
+    exit(1);
+  }
 
-    // hack to simplify debugging
-    // fcnt = 1;
+  sock.sun_family = AF_UNIX;
+  strcpy(sock.sun_path, argv[6]);
+  len = strlen(sock.sun_path) + sizeof(sock.sun_family);
 
-    if (fcnt == 0){
-      fprintf(stderr, "No valid trace files of name %s found\n", argv[6]);
-      exit(1);
+  if (bind(s, (sockaddr*)&sock, len) == -1){
+    perror("bind");
+    exit(1);
+  }
+  printf("Attempting to listen on socket %d\n", s);
+  listen(s, 5);
+  printf("Waiting for connection on socket %d\n", s);
+  if ((ns = accept(s, 0, 0)) == -1){
+    perror("accept");
+    exit(1);
+  }
+  printf("Connected!!\n\n");*/
+
+#ifndef REGRESS
+
+  // decode on a separate thread, simulate batches as they arrive; a
+  // sweep shares each decoded batch with one thread per hierarchy
+  trace_feeder* feed = open_feed(dir, app, ncfgs);
+  if (feed == 0){
+    exit(1);
+  }
+  double start = wtime();
+  feed->start();
+
+  if (ncfgs == 1){
+    simulate<DATA, OBS>(feed, hp, 0);
+  }else{
+    std::thread** workers = new std::thread*[ncfgs];
+    for (i32 k = 0;k < ncfgs;k++){
+      workers[k] = new std::thread(simulate<DATA, OBS>, feed, hps[k], k);
     }
-    
-    char *buf, *buf1, *buf2;
-    int bytes;
-
-    buf = new char[64];
-    buf1 = new char[256];
-    buf2 = new char[256];
-
-    for (unsigned int i = 0;i < fcnt;i++) {
-      char file[512];
-      sprintf(file, "%s/%s%d.log", argv[5], argv[6], i);
-      in = fopen(file, "r");
-      fprintf(stderr, "Reading from file %s\n", file);
-      if (in == NULL){
-	perror("Invalid file");
+    for (i32 k = 0;k < ncfgs;k++){
+      workers[k]->join();
+      delete workers[k];
+    }
+    delete[] workers;
+  }
+  feed->join();
+
+  const trace_stats* ts = feed->get_stats();
+  printf("Trace decode: %lu lines, %lu malformed, %.0f lines/s\n", ts->lines, ts->bad,
+         (ts->dtime > ts->iotime) ? ts->lines / (ts->dtime - ts->iotime) : 0.0);
+  ok = (ts->failed == 0);
+  if (ncfgs > 1){
+    printf("Swept %u configurations in %.2f s\n", ncfgs, wtime() - start);
+  }
+  delete feed;
+
+#else
+
+  tcache_t<DATA, OBS>* dl1 = hp->level(0);
+  printf("Starting cache sweep test\n");
+  unsigned int count = 0;
+  unsigned int matches = 0;
+
+  printf("Setting Memory Values\n");
+  for (unsigned int i=0;i<RANGE;i+=4){
+    unsigned long long data = i;
+    dl1->write(i, data);
+  }
+  
+  printf("Reading back Memory Values\n");
+  for (i32 j=0;j<4;j++){
+  for (unsigned int i=0;i<RANGE;i+=4){
+  unsigned long long exp = i;
+  unsigned long long act = dl1->read(i, 0);
+  if (DATA ? (exp != act) : ((act != 0) != (exp != 0))){
+  printf ("Data mismatch for address (%X), actual(%llX), expected(%llX)\n", i, act, exp);
+  count++;
+    }else{
+      matches++;
+    }
+
+    if (count > 10){
+      printf ("FAILED: too many read errors\n");
+      for (i32 c = 0;c < ncfgs;c++){
+	hps[c]->observer()->close();
       }
+      exit(1);
+    }
+  }
+}
+  printf("PASSED: %u accesses matched\n", matches);
 
-      while(fgets(buf, 64, in)){	
-	//printf("socket (%d, %d): %s\n", bytes, errno, buf);
-	sscanf(buf, "%s %x %s", buf1, &addr, buf2);
-	value = strtoull(buf2, NULL, 16);
-	//printf("%s\t%08X\t%llX\n", buf1, addr, value);
-	
-	isRead = strncmp(buf1, "read", 4);
-	if (mp != 0){
-	  zero = mp->lookup(addr);
-	}else{
-	  zero = 1; // do the lookup
+  // mixed block sizes with the map on: lines split from or merged into
+  // the map's blocks must still read back the last value written, also
+  // after runs of zero writes have had whole blocks dropped
+  printf("Mixed block size map test\n");
+  const char* mixed[] = {"L1:2:4:128,L2:2:16:64", "L1:2:4:32,L2:2:16:64",
+                         "L1:2:4:64,L2:2:16:32", "L1:2:4:64,L2:2:8:32,L3:2:32:64"};
+  const i64 span = RANGE;
+  i64* shadow = new i64[span >> 2];
+  for (i32 k = 0;k < 4;k++){
+    hier_cfg mc;
+    hier_parse_spec(&mc, mixed[k]);
+    mc.map_enable = 1;
+    mc.map_psize = 1024;
+    hierarchy_t<DATA>* mh = new hierarchy_t<DATA>(&mc, OFFSET);
+    memset(shadow, 0, (span >> 2) * sizeof(i64));
+    i64 x = 88172645463325252UL;
+    trace_rec r;
+    count = 0;
+    matches = 0;
+    for (i32 i = 0;i < (1 << 20);i++){
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      if (x % 20 == 0){
+	// zero a 256 B region, so blocks of every size become all zero
+	r.op = TR_WRITE;
+	r.value = 0;
+	for (i64 a = (x >> 8) & (span - 128);a < ((x >> 8) & (span - 128)) + 128;a += 4){
+	  r.addr = a;
+	  mh->access(&r);
+	  shadow[a >> 2] = 0;
 	}
-	//printf("result of lookup for address %08X in memmap: %d, is read?: %d\n", addr, zero,       strncmp(buf1, "write", 5));
-	dl1->set_anum(lines);
-	dl2->set_anum(lines);
-	
-	if (isRead == 0){
-	  // check the map first
-	  if (zero == 1){
-	    sval = dl1->read(addr, 0);
-	  }else{
-	    sval = 0;
-	  }
-	  if (sval != value){
-	    if (zero == 0){
-	      if (mp != 0){
-		mp->update_block(addr, 1);
-	      }
-	      dl1->allocate(addr);
-	      dl1->write(addr, value);
-	      dl1->set_accs(dl1->get_accs() - 2);
-	      dl1->set_hits(dl1->get_hits() - 2);
-	      //printf("UNMATCH: addr (%X): mem(%llX), trace(%llX)\n", addr, sval, value);
-	      mismatches++;
-	    }else{
-	      dl1->write(addr, value);
-	      dl1->set_accs(dl1->get_accs() - 1);
-	      dl1->set_hits(dl1->get_hits() - 1);
-	      //printf("Access(%u): Store and trace unmatched for addr (%X): s(%lX), t(%lX)\n", lines, addr, sval, value);
-	    }
-	  }else{
-	    if (sval == 0 && zero == 0 && mp != 0){
-	      mp->get_tlb()->zeros++;
-	    }
-	  }
-	}else{
-	  if (zero == 0 && mp != 0){
-	    mp->update_block(addr, 1);
-	    //printf("Calling cache_allocate for %08X\n", addr);
-	    dl1->allocate(addr); // special function to allocate a cache line with all zero
-	  }
-	  dl1->write(addr, value);
-	}	
-	lines++;
-
-	// clear stats collected during warmup
-	if (lines == skip){
-	  dl1->clearstats();
-	  dl2->clearstats();
-	  if (mp != 0){
-	    mp->clearstats();
-	  }
+	continue;
+      }
+      r.addr = (x >> 8) & (span - 4);
+      if ((x >> 32) % 10 < 4){
+	r.op = TR_WRITE;
+	r.value = ((x >> 36) & 1) ? 0 : ((x >> 16) | 1);
+	shadow[r.addr >> 2] = r.value;
+	mh->access(&r);
+	continue;
+      }
+      r.op = TR_READ;
+      r.value = shadow[r.addr >> 2];
+      i64 act = mh->access(&r);
+      if (DATA ? (act != r.value) : ((act != 0) != (r.value != 0))){
+	if (count < 10){
+	  printf("%s: read %u of (%lX), actual(%lX), expected(%lX)\n", mixed[k], i, r.addr, act, r.value);
 	}
+	count++;
+      }else{
+	matches++;
       }
     }
+    if (count != 0){
+      printf("FAILED: %s, %u of %u reads wrong\n", mixed[k], count, count + matches);
+      for (i32 c = 0;c < ncfgs;c++){
+	hps[c]->observer()->close();
+      }
+      exit(1);
+    }
+    printf("PASSED: %s, %u reads matched\n", mixed[k], matches);
+    delete mh;
+  }
+  delete[] shadow;
 
-#else
+#endif
 
-    printf("Starting cache sweep test\n");
-    unsigned int count = 0;
-    unsigned int matches = 0;
+  for (i32 k = 0;k < ncfgs;k++){
+    ok = hps[k]->observer()->close() && ok;
+    hps[k]->close_stats();
+  }
 
-    printf("Setting Memory Values\n");
-    for (unsigned int i=0;i<RANGE;i+=4){
-      unsigned long long data = i;
-      dl1->write(i, data);
+  for (i32 k = 0;k < ncfgs;k++){
+    if (ncfgs > 1){
+      printf("\nConfiguration %u:\n", k);
+      hier_print(&(cfgs[k]));
     }
-    
-    printf("Reading back Memory Values\n");
-    for (i32 j=0;j<4;j++){
-    for (unsigned int i=0;i<RANGE;i+=4){
-    unsigned long long exp = i;
-    unsigned long long act = dl1->read(i, 0);
-    if (exp != act){
-    printf ("Data mismatch for address (%X), actual(%llX), expected(%llX)\n", i, act, exp);
-    count++;
-      }else{
-	matches++;
-      }
+    hps[k]->stats();
+    if (ncfgs > 1 && k < ncfgs - 1){
+      printf("%lu initialization mismatches encountered\n", hps[k]->get_mismatches());
+      conflict_note(DATA, hps[k]->get_conflicts());
+    }
+  }
+  *lines = hp->get_lines();
+  *mismatches = hps[ncfgs-1]->get_mismatches();
+  *conflicts = hps[ncfgs-1]->get_conflicts();
+  for (i32 k = 0;k < ncfgs;k++){
+    delete hps[k];
+    free(tags[k]);
+  }
+  delete[] hps;
+  delete[] tags;
+  return ok;
+}
 
-      if (count > 10){
-	printf ("FAILED: too many read errors\n");
-	exit(1);
+int main(int argc, char** argv){
+  i64 lines = 0;
+  i64 mismatches = 0;
+  i64 conflicts = 0;
+  i32 ok = 1;
+  hier_cfg* cfgs = new hier_cfg[MAX_CONFIGS];
+  i32 ncfgs = 0;
+  i32 mrc_bsize = 0;
+  const char* mrc_filter = 0;
+  double mrc_rate = 1.0;
+  i32 tag_only = 0;
+  i32 dedup = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:H:S:m:f:r:TDz:R:B:i:jO:W:G:")) != -1){
+    if ((opt == 'c' || opt == 'H') && ncfgs == MAX_CONFIGS){
+      fprintf(stderr, "At most %u configurations are supported\n", MAX_CONFIGS);
+      return 1;
+    }
+    switch (opt){
+    case 'c':
+      if (hier_parse_file(&(cfgs[ncfgs]), optarg) == 0){
+	return 1;
+      }
+      ncfgs++;
+      break;
+    case 'H':
+      if (hier_parse_spec(&(cfgs[ncfgs]), optarg) == 0){
+	return 1;
+      }
+      ncfgs++;
+      break;
+    case 'S':
+      if (hier_parse_sweep(cfgs, &ncfgs, MAX_CONFIGS, optarg) == 0){
+	return 1;
+      }
+      break;
+    case 'T':
+      tag_only = 1;
+      break;
+    case 'D':
+      dedup = 1;
+      break;
+    case 'z':
+      {
+	int comp = vs_type(optarg);
+	if (comp < 0){
+	  fprintf(stderr, "Unknown compression %s\n", optarg);
+	  return 1;
+	}
+	vs_comp = comp;
+      }
+      break;
+    case 'R':
+      if (atol(optarg) <= 0){
+	fprintf(stderr, "Value trace files must hold at least one value\n");
+	return 1;
+      }
+      vs_recs = atol(optarg);
+      break;
+    case 'B':
+      if (atol(optarg) <= 0){
+	fprintf(stderr, "Value trace files must be allowed at least one MB\n");
+	return 1;
+      }
+      vs_bytes = atol(optarg) << 20;
+      break;
+    case 'i':
+      {
+	char* end;
+	long v = strtol(optarg, &end, 10);
+	if (end == optarg || *end != '\0' || v <= 0){
+	  fprintf(stderr, "Invalid interval %s, expected a positive number of accesses\n", optarg);
+	  usage(argv[0]);
+	  return 1;
+	}
+	st_interval = v;
+      }
+      break;
+    case 'j':
+      st_json = 1;
+      break;
+    case 'O':
+      if (parse_observers(optarg) == 0){
+	return 1;
+      }
+      break;
+    case 'W':
+      obs_watch = 1;
+      watch_addr = strtoul(optarg, 0, 16);
+      break;
+    case 'G':
+      synth = new synth_gen();
+      if (synth->parse(optarg) == 0){
+	return 1;
       }
+      break;
+    case 'm':
+      mrc_bsize = atoi(optarg);
+      break;
+    case 'f':
+      mrc_filter = optarg;
+      break;
+    case 'r':
+      mrc_rate = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
     }
   }
-    printf("PASSED: %u accesses matched\n", matches);
-    
-#endif
+  char** args = argv + optind;
+  // generated accesses take the place of the trace directory
+  int ndir = (synth == 0);
 
-    if (mp != 0){
-      mp->stats();
+  if (mrc_bsize != 0){
+    if (ncfgs != 0 || argc - optind != 2 + ndir){
+      usage(argv[0]);
+      return 1;
+    }
+    return run_mrc(mrc_bsize, mrc_filter, mrc_rate, atoi(args[0]) * 1000000,
+		   ndir ? args[1] : 0, args[1 + ndir]);
+  }
+
+  if (argc - optind != (ncfgs ? 2 : 5) + ndir){
+    usage(argv[0]);
+  }else{
+    unsigned int skip;
+    char *dir, *app;
+
+    // read input arguments
+    if (ncfgs == 0){
+      if (hier_default(&(cfgs[0]), atoi(args[0]), atoi(args[1]), atoi(args[2])) == 0){
+	usage(argv[0]);
+	return 1;
+      }
+      ncfgs = 1;
+      args += 3;
     }
-    if (dl1 != 0){
-      dl1->stats();
+    for (i32 k = 0;k < ncfgs;k++){
+      cfgs[k].mem_dedup = dedup;
     }
-    if (dl2 != 0){
-      dl2->stats();
+    skip = atoi(args[0]) * 1000000;
+    dir = ndir ? args[1] : 0;
+    app = args[1 + ndir];
+
+    // without observers the simulator is built with none at all
+    i32 observed = obs_taint || obs_values || obs_sets || obs_watch;
+    if (tag_only == 0){
+      if (observed){
+	ok = run<1, sim_observer>(cfgs, ncfgs, skip, dir, app, &lines, &mismatches, &conflicts);
+      }else{
+	ok = run<1, no_observer>(cfgs, ncfgs, skip, dir, app, &lines, &mismatches, &conflicts);
+      }
+    }else{
+      for (i32 k = 0;k < ncfgs;k++){
+	for (i32 l = 0;l < cfgs[k].nlevels;l++){
+	  if (cfgs[k].levels[l].bsize > 512){
+	    fprintf(stderr, "Tag-only levels need blocks of at most 512 B\n");
+	    return 1;
+	  }
+	}
+      }
+      if (observed){
+	ok = run<0, sim_observer>(cfgs, ncfgs, skip, dir, app, &lines, &mismatches, &conflicts);
+      }else{
+	ok = run<0, no_observer>(cfgs, ncfgs, skip, dir, app, &lines, &mismatches, &conflicts);
+      }
     }
   }
 
   printf("%lu initialization mismatches encountered\n", mismatches);
-  printf("Simulation complete after %u accesses\n", lines);
+  conflict_note(!tag_only, conflicts);
+  printf("Simulation complete after %lu accesses\n", lines);
+  printf("Peak RSS: %lu KB\n", peak_rss());
 
-  return 0;
+  delete[] cfgs;
+  delete synth;
+  return ok ? 0 : 1;
 }
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <unordered_map>
+
+#include "hier.h"
+#include "refsim.h"
+#include "synth.h"
+
+// differential test of the simulator against the reference model of
+// refsim.h: both take the same accesses in lockstep, and the value each
+// read returns and every counter of every level are compared after each
+// access. At the first difference the run stops, and the shortest window
+// of the accesses leading up to it that still makes the two differ from
+// a cold start is written out as a text trace. Under -T the tag-only
+// simulator is checked, which only knows whether the words it reads are
+// nonzero; it is expected to differ once the reference reads a nonzero
+// word other than the trace's nonzero value, and such reads are counted.
+// Both are also held to the trace itself: a read must return the last
+// value stored to its word, by a write or by a read that found another
+// value and stored the trace's. This is only checked with the map enabled
+// and at most 32 blocks to a page, as the map drops the writebacks of zero
+// lines even while disabled, and blocks 32 apart share a zero bit.
+
+#define OFFSET 1
+#define DIFF_WINDOW (1 << 16) // accesses kept for the reproducing window
+
+// a counter of the simulator and the model's counter of the same name
+typedef struct diff_pair_t {
+  const char* name;
+  const i64* sim;
+  const i64* ref;
+} diff_pair;
+
+template <i32 DATA>
+class diff_run {
+  hierarchy_t<DATA>* sim;
+  ref_hierarchy* ref;
+  stat_registry sreg;
+  stat_registry rreg;
+  std::vector<diff_pair> pairs;
+  std::unordered_map<i64, i64> shadow; // the last value stored to each word
+  i32 vcheck; // reads are checked against shadow
+  i64 steps;
+  i64 conflicts; // reads of a nonzero word other than the trace's nonzero value
+  i64 first_conflict;
+ public:
+  diff_run(hier_cfg* cfg);
+  ~diff_run();
+  // 1 if the two agree after rec, otherwise 0 with what differs in why
+  i32 step(const trace_rec* rec, char* why, i32 len);
+  i32 counters();
+  i64 get_conflicts();
+  i64 get_first_conflict();
+};
+
+template <i32 DATA>
+diff_run<DATA>::diff_run(hier_cfg* cfg){
+  sim = new hierarchy_t<DATA>(cfg, OFFSET);
+  ref = new ref_hierarchy(cfg, OFFSET);
+  for (i32 i = 0;i < cfg->nlevels;i++){
+    sim->level(i)->reg_stats(&sreg);
+  }
+  ref->reg_stats(&rreg, cfg);
+  vcheck = cfg->map_enable && cfg->map_psize / cfg->levels[cfg->nlevels-1].bsize <= 32;
+  steps = conflicts = first_conflict = 0;
+  for (i32 i = 0;i < sreg.size();i++){
+    for (i32 j = 0;j < rreg.size();j++){
+      if (strcmp(sreg.name(i), rreg.name(j)) == 0){
+	pairs.push_back({ sreg.name(i), sreg.counter(i), rreg.counter(j) });
+	break;
+      }
+    }
+  }
+}
+
+template <i32 DATA>
+diff_run<DATA>::~diff_run(){
+  delete sim;
+  delete ref;
+}
+
+template <i32 DATA>
+i32 diff_run<DATA>::step(const trace_rec* rec, char* why, i32 len){
+  i64 s = sim->access(rec);
+  i64 r = ref->access(rec);
+  i64 word = rec->addr >> (3 - OFFSET);
+  i32 n = 0;
+
+  if (rec->op == TR_READ && r != 0 && rec->value != 0 && r != rec->value){
+    first_conflict = (conflicts == 0) ? steps : first_conflict;
+    conflicts++;
+  }
+  steps++;
+  if (DATA ? (s != r) : ((s != 0) != (r != 0))){
+    n += snprintf(why + n, len - n, "  %s of %lx returned %lx, reference %lx\n",
+		  (rec->op == TR_READ) ? "read" : "write", rec->addr, s, r);
+  }
+  if (vcheck){
+    auto it = shadow.find(word);
+    i64 last = (it == shadow.end()) ? 0 : it->second;
+    if (rec->op == TR_READ && (DATA ? (s != last) : ((s != 0) != (last != 0))) && n < len){
+      n += snprintf(why + n, len - n, "  read of %lx returned %lx, the last value stored there is %lx\n", rec->addr, s, last);
+    }
+    if (rec->value == 0){
+      shadow.erase(word);
+    }else{
+      shadow[word] = rec->value;
+    }
+  }
+  for (size_t i = 0;i < pairs.size();i++){
+    if (*(pairs[i].sim) != *(pairs[i].ref) && n < len){
+      n += snprintf(why + n, len - n, "  %s is %lu, reference %lu\n", pairs[i].name, *(pairs[i].sim), *(pairs[i].ref));
+    }
+  }
+  if (sim->get_mismatches() != ref->get_mismatches() && n < len){
+    n += snprintf(why + n, len - n, "  %lu initialization mismatches, reference %lu\n",
+		  sim->get_mismatches(), ref->get_mismatches());
+  }
+  return n == 0;
+}
+
+template <i32 DATA>
+i32 diff_run<DATA>::counters(){
+  return pairs.size();
+}
+
+template <i32 DATA>
+i64 diff_run<DATA>::get_conflicts(){
+  return conflicts;
+}
+
+template <i32 DATA>
+i64 diff_run<DATA>::get_first_conflict(){
+  return first_conflict;
+}
+
+// index of the first access of recs[0..n) the two differ after, from a
+// cold start, or -1
+template <i32 DATA>
+static int replay(hier_cfg* cfg, const trace_rec* recs, i64 n){
+  diff_run<DATA> d(cfg);
+  char why[256];
+  for (i64 i = 0;i < n;i++){
+    if (d.step(&(recs[i]), why, sizeof(why)) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+// the shortest tail of recs[0..n) found to make the two differ, by
+// doubling and then bisecting its length; as a difference need not show
+// in every longer window, this is short rather than strictly shortest.
+// Sets *len to the accesses up to the difference, 0 if none shows.
+template <i32 DATA>
+static const trace_rec* shortest_window(hier_cfg* cfg, const trace_rec* recs, i64 n, i64* len){
+  i64 lo = 0, hi = 0;
+  int d;
+
+  for (i64 w = 1;hi == 0;w *= 2){
+    w = (w > n) ? n : w;
+    if (replay<DATA>(cfg, recs + n - w, w) >= 0){
+      hi = w;
+    }else if (w == n){
+      *len = 0;
+      return recs;
+    }else{
+      lo = w;
+    }
+  }
+  while (hi - lo > 1){
+    i64 mid = (lo + hi) / 2;
+    if (replay<DATA>(cfg, recs + n - mid, mid) >= 0){
+      hi = mid;
+    }else{
+      lo = mid;
+    }
+  }
+  d = replay<DATA>(cfg, recs + n - hi, hi);
+  *len = d + 1;
+  return recs + n - hi;
+}
+
+static void print_rec(FILE* fp, const trace_rec* r){
+  fprintf(fp, "%s %lx %lx\n", (r->op == TR_READ) ? "read" : "write", r->addr, r->value);
+}
+
+template <i32 DATA>
+static int run(hier_cfg* cfg, trace_feeder* feed, i64 max, i32 wlen, const char* app, const char* cfgarg){
+  diff_run<DATA> d(cfg);
+  trace_rec* win = new trace_rec[wlen];
+  trace_batch* batch;
+  char why[4096];
+  i64 n = 0;
+  i32 diverged = 0;
+  double start = wtime();
+
+  feed->start();
+  while (!diverged && n < max && (batch = feed->next()) != 0){
+    for (i32 i = 0;i < batch->n && n < max;i++){
+      win[n & (wlen - 1)] = batch->recs[i];
+      if (d.step(&(batch->recs[i]), why, sizeof(why)) == 0){
+	diverged = 1;
+	break;
+      }
+      n++;
+    }
+    feed->release();
+  }
+  // let the decode thread run to the end of the trace
+  while ((batch = feed->next()) != 0){
+    feed->release();
+  }
+  feed->join();
+
+  if (!diverged){
+    double t = wtime() - start;
+    delete[] win;
+    printf("%lu accesses in %.2f s (%.0f/s): every value and all %u counters match the reference\n",
+	   n, t, (t > 0) ? n / t : 0.0, d.counters());
+    return (feed->get_stats()->failed == 0) ? 0 : 1;
+  }
+
+  const trace_rec* r = &(win[n & (wlen - 1)]);
+  printf("Access %lu differs from the reference: ", n);
+  print_rec(stdout, r);
+  printf("%s", why);
+  if (!DATA && d.get_conflicts() != 0){
+    printf("From access %lu on, %lu reads found a nonzero word other than the trace's nonzero value,\n"
+	   "which the tag-only simulator takes to hold the trace's value\n", d.get_first_conflict(), d.get_conflicts());
+  }
+
+  // the last accesses in order, ending with the one that differs
+  i64 kept = (n + 1 < wlen) ? n + 1 : wlen;
+  trace_rec* tail = new trace_rec[kept];
+  for (i64 i = 0;i < kept;i++){
+    tail[i] = win[(n + 1 - kept + i) & (wlen - 1)];
+  }
+  delete[] win;
+  i64 len;
+  const trace_rec* w = shortest_window<DATA>(cfg, tail, kept, &len);
+  if (len == 0){
+    printf("No window of the last %lu accesses differs from a cold start; try a larger -w\n", kept);
+    delete[] tail;
+    return 1;
+  }
+
+  char file[512];
+  snprintf(file, sizeof(file), "%s-diverge0.log", app);
+  FILE* fp = fopen(file, "w");
+  if (fp == NULL){
+    perror(file);
+    delete[] tail;
+    return 1;
+  }
+  for (i64 i = 0;i < len;i++){
+    print_rec(fp, &(w[i]));
+  }
+  fclose(fp);
+
+  printf("Reproduced from a cold start by %lu accesses, written to %s:\n", len, file);
+  for (i64 i = 0;i < len && i < 16;i++){
+    printf("  ");
+    print_rec(stdout, &(w[i]));
+  }
+  if (len > 16){
+    printf("  ...\n");
+  }
+  printf("Rerun with: cache_diff %s%s . %s-diverge\n", DATA ? "" : "-T ", cfgarg, app);
+  delete[] tail;
+  return 1;
+}
+
+static void usage(const char* prog){
+  printf("usage: %s [-T] -c config | -H spec [-n accesses] [-w window] (dir) filename\n", prog);
+  printf("       %s [-T] -c config | -H spec [-n accesses] [-w window] -G spec filename\n", prog);
+  printf("  -T         check the tag-only simulator\n");
+  printf("  -n count   stop after count accesses\n");
+  printf("  -w count   accesses kept for the reproducing window (%u), a power of two\n", DIFF_WINDOW);
+  printf("  -G spec    synthetic accesses, as in cache_sim\n");
+}
+
+int main(int argc, char** argv){
+  hier_cfg cfg;
+  char cfgarg[600] = "";
+  synth_gen* synth = 0;
+  i32 tag_only = 0, have_cfg = 0;
+  i32 wlen = DIFF_WINDOW;
+  i64 max = ~0UL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:H:Tn:w:G:")) != -1){
+    switch (opt){
+    case 'c':
+      if (hier_parse_file(&cfg, optarg) == 0){
+	return 1;
+      }
+      snprintf(cfgarg, sizeof(cfgarg), "-c %s", optarg);
+      have_cfg = 1;
+      break;
+    case 'H':
+      if (hier_parse_spec(&cfg, optarg) == 0){
+	return 1;
+      }
+      snprintf(cfgarg, sizeof(cfgarg), "-H %s", optarg);
+      have_cfg = 1;
+      break;
+    case 'T':
+      tag_only = 1;
+      break;
+    case 'n':
+      max = atol(optarg);
+      break;
+    case 'w':
+      wlen = atoi(optarg);
+      break;
+    case 'G':
+      synth = new synth_gen();
+      if (synth->parse(optarg) == 0){
+	return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  char** args = argv + optind;
+  int ndir = (synth == 0);
+  if (!have_cfg || argc - optind != 1 + ndir || !pow2(wlen)){
+    usage(argv[0]);
+    return 1;
+  }
+  for (i32 i = 0;i < cfg.nlevels;i++){
+    if (tag_only && cfg.levels[i].bsize > 512){
+      fprintf(stderr, "%s: tag-only levels are limited to 512 B blocks\n", cfg.levels[i].name);
+      return 1;
+    }
+  }
+
+  trace_feeder* feed;
+  if (synth != 0){
+    feed = new trace_feeder(synth);
+  }else{
+    char file[512];
+    i32 fcnt;
+    for (fcnt = 0;trace_find(file, args[0], args[1], fcnt);fcnt++);
+    if (fcnt == 0){
+      fprintf(stderr, "No traces %s/%s<N> found\n", args[0], args[1]);
+      return 1;
+    }
+    feed = new trace_feeder(args[0], args[1], fcnt);
+  }
+  const char* app = args[ndir];
+  int rc = tag_only ? run<0>(&cfg, feed, max, wlen, app, cfgarg) : run<1>(&cfg, feed, max, wlen, app, cfgarg);
+  delete feed;
+  delete synth;
+  return rc;
+}
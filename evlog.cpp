@@ -0,0 +1,76 @@
+#include "evlog.h"
+#include <string.h>
+#include <assert.h>
+
+event_log::event_log(){
+  out = 0;
+}
+
+i32 event_log::open(const char* file, const char** names, i32 nlevels){
+  evlog_hdr hdr;
+
+  assert(nlevels <= EV_MAX_LEVELS);
+  out = fopen(file, "wb");
+  if (out == NULL){
+    return 0;
+  }
+  memset(&hdr, 0, sizeof(evlog_hdr));
+  hdr.magic = EVLOG_MAGIC;
+  hdr.version = EVLOG_VERSION;
+  hdr.nlevels = nlevels;
+  for (i32 i = 0;i < nlevels;i++){
+    strncpy(hdr.names[i], names[i], sizeof(hdr.names[i]) - 1);
+  }
+  fwrite(&hdr, sizeof(evlog_hdr), 1, out);
+  start();
+  return 1;
+}
+
+void event_log::emit(const unsigned char* b, i32 len){
+  fwrite(b, 1, len, out);
+}
+
+void event_log::finish(){
+  fclose(out);
+  out = 0;
+}
+
+i32 evlog_decode(const char* infile, FILE* out, i64* count){
+  evlog_hdr hdr;
+  unsigned char* b;
+  size_t got;
+  FILE* in = fopen(infile, "rb");
+
+  *count = 0;
+  if (in == NULL){
+    perror(infile);
+    return 0;
+  }
+  if (fread(&hdr, sizeof(evlog_hdr), 1, in) != 1 || hdr.magic != EVLOG_MAGIC ||
+      hdr.version != EVLOG_VERSION || hdr.nlevels > EV_MAX_LEVELS){
+    fprintf(stderr, "%s: not an event log\n", infile);
+    fclose(in);
+    return 0;
+  }
+
+  b = new unsigned char[SINK_BUF];
+  while ((got = fread(b, 1, SINK_BUF, in)) > 0){
+    for (size_t i = 0;i < got;i++){
+      if (b[i] == EV_MEM){
+	fputs("m\n", out);
+      }else if (b[i] < hdr.nlevels){
+	fputs(hdr.names[b[i]], out);
+	fputc('\n', out);
+      }else{
+	fprintf(stderr, "%s: bad event %u at %lu\n", infile, b[i], *count);
+	delete[] b;
+	fclose(in);
+	return 0;
+      }
+      (*count)++;
+    }
+  }
+  delete[] b;
+  fclose(in);
+  return 1;
+}
@@ -0,0 +1,44 @@
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include "sink.h"
+
+// binary access log: one byte per event, the index of the level a read or
+// write hit in, or EV_MEM for a line filled from memory. The header names
+// the levels so the log can be turned back into the text form, one level
+// name or "m" per line (evlog_dump).
+
+#define EVLOG_MAGIC 0x474C5645 // "EVLG"
+#define EVLOG_VERSION 1
+#define EV_MAX_LEVELS 16
+#define EV_MEM 0xFF
+
+typedef struct evlog_hdr_t {
+  i32 magic;
+  i32 version;
+  i32 nlevels;
+  i32 flags;
+  char names[EV_MAX_LEVELS][16];
+} evlog_hdr;
+
+class event_log : public buf_sink {
+  FILE* out;
+ protected:
+  void emit(const unsigned char* b, i32 len);
+  void finish();
+ public:
+  event_log();
+  i32 open(const char* file, const char** names, i32 nlevels);
+  inline void event(i32 ev){
+    buf[n++] = ev;
+    if (n == SINK_BUF){
+      flush();
+    }
+  }
+};
+
+// write an event log out as text and the number of events to *count;
+// returns 0 on failure
+i32 evlog_decode(const char* infile, FILE* out, i64* count);
+
+#endif /* EVLOG_H */
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "zpipe.h"
+#include "evlog.h"
+
+// writes the binary logs out in their text form: an access log
+// (<app>-taint.evl) as one level name or "m" per event, a value trace
+// (<app>_l2trace<N>.vtr[.gz|.zst]) as one hex value per line
+
+// 0 on failure
+static i32 dump_values(const char* file, FILE* out, i64* count){
+  zpipe zp;
+  i32 type = zpipe_type(file);
+  FILE* in;
+  i32 ok;
+
+  in = (type == ZP_NONE) ? fopen(file, "r") : zp.open(file, type);
+  if (in == NULL){
+    perror(file);
+    return 0;
+  }
+  ok = vtrace_decode(in, file, out, count);
+  if (type == ZP_NONE){
+    fclose(in);
+  }
+  zp.close();
+  return ok;
+}
+
+int main(int argc, char** argv){
+  if (argc != 2 && argc != 3){
+    printf("usage: %s log.evl|trace.vtr[.gz|.zst] [out.log]\n", argv[0]);
+    return 1;
+  }
+
+  FILE* out = stdout;
+  if (argc == 3){
+    out = fopen(argv[2], "w");
+    if (out == NULL){
+      perror(argv[2]);
+      return 1;
+    }
+  }
+  i64 n;
+  i32 ok;
+  if (strstr(argv[1], ".vtr") != NULL){
+    ok = dump_values(argv[1], out, &n);
+  }
+  else {
+    ok = evlog_decode(argv[1], out, &n);
+  }
+  if (ok == 0){
+    return 1;
+  }
+  fclose(out);
+  if (argc == 3){
+    fprintf(stderr, "Wrote %lu records to %s\n", n, argv[2]);
+  }
+  return 0;
+}
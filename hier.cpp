@@ -0,0 +1,469 @@
+#include "hier.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* policies[] = { "lru", "fifo", "random", 0 };
+
+// no levels and the original memory map: disabled, 4 KB pages, 32 entries
+static void hier_reset(hier_cfg* cfg){
+  memset(cfg, 0, sizeof(hier_cfg));
+  cfg->map_enable = 0;
+  cfg->map_psize = 4096;
+  cfg->map_tlb = 32;
+  cfg->mem_dedup = 0;
+}
+
+// 0, with the reason on stderr, if the level's fields don't make a cache
+static i32 check_level(level_cfg* lp){
+  if (!pow2(lp->sets) || !pow2(lp->bsize) || lp->bsize < 8 ||
+      lp->assoc == 0 || lp->assoc > MAX_ASSOC){
+    fprintf(stderr, "%s: invalid geometry (%u-way, %u sets, %u B blocks)\n", lp->name, lp->assoc, lp->sets, lp->bsize);
+    return 0;
+  }
+  return 1;
+}
+
+i32 hier_default(hier_cfg* cfg, i32 assoc, i32 sets, i32 bsize){
+  hier_reset(cfg);
+  cfg->nlevels = 2;
+  strcpy(cfg->levels[0].name, "L1");
+  cfg->levels[0].sets = 32;
+  cfg->levels[0].bsize = bsize;
+  cfg->levels[0].assoc = 2;
+  strcpy(cfg->levels[1].name, "L2");
+  cfg->levels[1].sets = sets;
+  cfg->levels[1].bsize = bsize;
+  cfg->levels[1].assoc = assoc;
+  return check_level(&(cfg->levels[0])) && check_level(&(cfg->levels[1]));
+}
+
+// fill in one level from its fields, returns 0 if they don't make a cache
+static i32 set_level(hier_cfg* cfg, char** f, i32 nf){
+  level_cfg* lp;
+  i32 i;
+
+  if (cfg->nlevels == MAX_LEVELS){
+    fprintf(stderr, "At most %u cache levels are supported\n", MAX_LEVELS);
+    return 0;
+  }
+  if (nf < 4 || nf > 5){
+    fprintf(stderr, "Cache level needs name, associativity, sets, bsize and an optional policy\n");
+    return 0;
+  }
+
+  lp = &(cfg->levels[cfg->nlevels]);
+  snprintf(lp->name, sizeof(lp->name), "%s", f[0]);
+  lp->assoc = atoi(f[1]);
+  lp->sets = atoi(f[2]);
+  lp->bsize = atoi(f[3]);
+  lp->policy = POL_LRU;
+  if (nf == 5){
+    for (i = 0;policies[i] != 0 && strcmp(policies[i], f[4]) != 0;i++);
+    if (policies[i] == 0){
+      fprintf(stderr, "%s: unknown replacement policy %s\n", lp->name, f[4]);
+      return 0;
+    }
+    lp->policy = i;
+  }
+
+  if (check_level(lp) == 0){
+    return 0;
+  }
+  cfg->nlevels++;
+  return 1;
+}
+
+// split s in place at any of the delimiters
+static i32 split(char* s, const char* delim, char** f, i32 max){
+  i32 n = 0;
+  char* save;
+  for (char* t = strtok_r(s, delim, &save);t != 0 && n < max;t = strtok_r(0, delim, &save)){
+    f[n++] = t;
+  }
+  return n;
+}
+
+i32 hier_parse_spec(hier_cfg* cfg, const char* spec){
+  char* copy = strdup(spec);
+  char* save;
+  char* f[8];
+
+  hier_reset(cfg);
+  for (char* lv = strtok_r(copy, ",", &save);lv != 0;lv = strtok_r(0, ",", &save)){
+    if (set_level(cfg, f, split(lv, ":", f, 8)) == 0){
+      free(copy);
+      return 0;
+    }
+  }
+  free(copy);
+
+  if (cfg->nlevels == 0){
+    fprintf(stderr, "Empty cache hierarchy spec\n");
+    return 0;
+  }
+  return 1;
+}
+
+// n entries of assoc ways, 0 ways for fully associative
+static i32 tlb_geometry(i32 n, i32 assoc){
+  if (n <= 0 || n > 65536){
+    return 0;
+  }
+  if (assoc == 0 || assoc == n){
+    return 1;
+  }
+  return assoc > 0 && assoc <= MAX_ASSOC && n % assoc == 0 && pow2(n / assoc);
+}
+
+i32 hier_parse_file(hier_cfg* cfg, const char* file){
+  char line[512];
+  char* f[8];
+  i32 lineno = 0;
+  FILE* in = fopen(file, "r");
+
+  if (in == NULL){
+    perror(file);
+    return 0;
+  }
+
+  hier_reset(cfg);
+  while (fgets(line, sizeof(line), in)){
+    lineno++;
+    char* c = strchr(line, '#');
+    if (c != 0){
+      *c = 0;
+    }
+    i32 nf = split(line, " \t\r\n", f, 8);
+    if (nf == 0){
+      continue;
+    }
+    if (strcmp(f[0], "level") == 0 && set_level(cfg, f + 1, nf - 1)){
+      continue;
+    }
+    if (strcmp(f[0], "map") == 0 && nf >= 4 && nf <= 7){
+      cfg->map_enable = atoi(f[1]);
+      cfg->map_psize = atoi(f[2]);
+      cfg->map_tlb = atoi(f[3]);
+      cfg->map_tlb_assoc = (nf > 4) ? atoi(f[4]) : 0;
+      cfg->map_tlb2 = (nf > 5) ? atoi(f[5]) : 0;
+      cfg->map_tlb2_assoc = (nf > 6) ? atoi(f[6]) : 0;
+      if (pow2(cfg->map_psize) && cfg->map_psize >= 1024 && cfg->map_tlb > 0 &&
+	  tlb_geometry(cfg->map_tlb, cfg->map_tlb_assoc) &&
+	  tlb_geometry(cfg->map_tlb2 ? cfg->map_tlb2 : (cfg->map_tlb << 2), cfg->map_tlb2_assoc)){
+	continue;
+      }
+    }
+    fprintf(stderr, "%s:%u: invalid hierarchy line\n", file, lineno);
+    fclose(in);
+    return 0;
+  }
+  fclose(in);
+
+  if (cfg->nlevels == 0){
+    fprintf(stderr, "%s: no cache levels defined\n", file);
+    return 0;
+  }
+  return 1;
+}
+
+i32 hier_parse_sweep(hier_cfg* cfgs, i32* n, i32 max, const char* file){
+  char line[512];
+  char* f[2];
+  i32 lineno = 0;
+  FILE* in = fopen(file, "r");
+
+  if (in == NULL){
+    perror(file);
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), in)){
+    lineno++;
+    char* c = strchr(line, '#');
+    if (c != 0){
+      *c = 0;
+    }
+    if (split(line, " \t\r\n", f, 2) == 0){
+      continue;
+    }
+    if (*n == max){
+      fprintf(stderr, "%s:%u: at most %u configurations are supported\n", file, lineno, max);
+      fclose(in);
+      return 0;
+    }
+    if (hier_parse_spec(&(cfgs[*n]), f[0]) == 0){
+      fprintf(stderr, "%s:%u: invalid hierarchy spec\n", file, lineno);
+      fclose(in);
+      return 0;
+    }
+    (*n)++;
+  }
+  fclose(in);
+  return 1;
+}
+
+void hier_print(hier_cfg* cfg){
+  for (i32 i = 0;i < cfg->nlevels;i++){
+    level_cfg* lp = &(cfg->levels[i]);
+    printf("%s: %u sets, %u-way, %u B blocks, %s\n", lp->name, lp->sets, lp->assoc, lp->bsize, policies[lp->policy]);
+  }
+}
+
+template <i32 DATA, class OBS>
+hierarchy_t<DATA, OBS>::hierarchy_t(hier_cfg* cfg, i32 ofs){
+  nlevels = cfg->nlevels;
+  levels = new tcache_t<DATA, OBS>*[nlevels];
+  names = new char*[nlevels];
+  for (i32 i = 0;i < nlevels;i++){
+    level_cfg* lp = &(cfg->levels[i]);
+    levels[i] = new tcache_t<DATA, OBS>(lp->sets, lp->bsize, lp->assoc, ofs);
+    names[i] = strdup(lp->name);
+    levels[i]->set_name(names[i]);
+    levels[i]->set_policy(lp->policy);
+    if (i > 0){
+      levels[i-1]->set_nl(levels[i]);
+    }
+  }
+
+  // the last level fills from and writes back to memory, so the map
+  // tracks zero lines at its block size
+  mp = new mem_map(cfg->map_enable, cfg->map_psize, cfg->levels[nlevels-1].bsize, cfg->map_tlb, ofs,
+		   cfg->map_tlb_assoc, cfg->map_tlb2, cfg->map_tlb2_assoc);
+  sp = new tmemory(ofs);
+  sp->set_dedup(cfg->mem_dedup);
+  levels[nlevels-1]->set_mem(sp);
+  levels[nlevels-1]->set_map(mp);
+
+  mixed = 0;
+  for (i32 i = 0;i < nlevels;i++){
+    mixed |= (cfg->levels[i].bsize != cfg->levels[nlevels-1].bsize);
+  }
+  l1fits = (cfg->levels[0].bsize <= cfg->levels[nlevels-1].bsize);
+  mshift = log2(cfg->levels[nlevels-1].bsize) - ofs;
+  mwords = cfg->levels[nlevels-1].bsize >> 3;
+  mzero = new i64[mwords]();
+
+  lines = 0;
+  mismatches = 0;
+  conflicts = 0;
+  skip = 0;
+  st = 0;
+  snext = ~0UL;
+  sint = 0;
+
+  obs = new OBS();
+  for (i32 i = 0;i < nlevels;i++){
+    levels[i]->set_observer(obs, i);
+  }
+}
+
+template <i32 DATA, class OBS>
+hierarchy_t<DATA, OBS>::~hierarchy_t(){
+  for (i32 i = 0;i < nlevels;i++){
+    delete levels[i];
+    free(names[i]);
+  }
+  delete[] levels;
+  delete[] names;
+  delete mp;
+  delete sp;
+  delete[] mzero;
+  delete st;
+  delete obs;
+}
+
+template <i32 DATA, class OBS>
+OBS* hierarchy_t<DATA, OBS>::observer(){
+  return obs;
+}
+
+template <i32 DATA, class OBS>
+void hierarchy_t<DATA, OBS>::set_skip(i64 n){
+  skip = n;
+}
+
+template <i32 DATA, class OBS>
+i32 hierarchy_t<DATA, OBS>::set_stats(const char* file, i64 interval, i32 json){
+  st = new stat_registry();
+  for (i32 i = 0;i < nlevels;i++){
+    levels[i]->reg_stats(st);
+  }
+  mp->reg_stats(st);
+  if (st->open(file, json) == 0){
+    delete st;
+    st = 0;
+    return 0;
+  }
+  sint = interval;
+  snext = lines + interval;
+  return 1;
+}
+
+// the last, partial interval is sampled as well
+template <i32 DATA, class OBS>
+void hierarchy_t<DATA, OBS>::close_stats(){
+  if (st != 0){
+    st->sample(lines);
+    st->close();
+  }
+}
+
+template <i32 DATA, class OBS>
+tcache_t<DATA, OBS>* hierarchy_t<DATA, OBS>::level(i32 n){
+  return levels[n];
+}
+
+template <i32 DATA, class OBS>
+i64 hierarchy_t<DATA, OBS>::get_lines(){
+  return lines;
+}
+
+template <i32 DATA, class OBS>
+i64 hierarchy_t<DATA, OBS>::get_mismatches(){
+  return mismatches;
+}
+
+template <i32 DATA, class OBS>
+i64 hierarchy_t<DATA, OBS>::get_conflicts(){
+  return conflicts;
+}
+
+// the map's block of addr may now hold nonzero words. Memory's copy of a
+// block the map holds as zero is stale and read as zero; lines smaller
+// than the block are merged into that copy once they are written back,
+// so with lines of other sizes it is made zero first.
+template <i32 DATA, class OBS>
+void hierarchy_t<DATA, OBS>::mark_nonzero(i64 addr){
+  mp->update_block(addr, 1);
+  obs->map_update(addr, 1);
+  if (mixed){
+    if (DATA){
+      sp->write_block(addr & (~0UL << mshift), mzero, mwords);
+    }else{
+      sp->write_bits(addr & (~0UL << mshift), 0, mwords);
+    }
+  }
+}
+
+template <i32 DATA, class OBS>
+i64 hierarchy_t<DATA, OBS>::access(const trace_rec* rec){
+  tcache_t<DATA, OBS>* dl1 = levels[0];
+  i64 addr = rec->addr;
+  i64 value = rec->value;
+  i64 sval;
+  i32 zero;
+
+  if (mp != 0){
+    zero = mp->lookup(addr);
+  }else{
+    zero = 1; // do the lookup
+  }
+  //printf("result of lookup for address %08X in memmap: %d, is read?: %d\n", addr, zero, rec->op == TR_READ);
+
+  if (rec->op == TR_READ){
+    // check the map first
+    if (zero == 1){
+      sval = dl1->read(addr, 0);
+      if (DATA == 0){
+	// only whether the word is nonzero is known, a nonzero word is
+	// taken to hold the trace's value
+	sval = (sval == 0) ? 0 : ((value != 0) ? value : 1);
+      }
+    }else{
+      sval = 0;
+    }
+    if (sval != value){
+      if (zero == 0){
+	if (mp != 0){
+	  mark_nonzero(addr);
+	}
+	if (l1fits){
+	  dl1->allocate(addr);
+	  dl1->write(addr, value);
+	  dl1->set_accs(dl1->get_accs() - 2);
+	  dl1->set_hits(dl1->get_hits() - 2);
+	}else{
+	  // the line spans other blocks, which may hold nonzero words
+	  dl1->write(addr, value);
+	  dl1->set_accs(dl1->get_accs() - 1);
+	  dl1->set_hits(dl1->get_hits() - 1);
+	}
+	//printf("UNMATCH: addr (%X): mem(%llX), trace(%llX)\n", addr, sval, value);
+	mismatches++;
+      }else{
+	// a cached nonzero word other than a nonzero trace value is
+	// rewritten and dirtied, which a tag-only run cannot see
+	if (sval != 0 && value != 0){
+	  conflicts++;
+	}
+	dl1->write(addr, value);
+	dl1->set_accs(dl1->get_accs() - 1);
+	dl1->set_hits(dl1->get_hits() - 1);
+	//printf("Access(%u): Store and trace unmatched for addr (%X): s(%lX), t(%lX)\n", lines, addr, sval, value);
+      }
+    }else{
+      if (sval == 0 && zero == 0 && mp != 0){
+	mp->get_tlb()->zeros++;
+      }
+    }
+  }else{
+    if (zero == 0 && mp != 0){
+      mark_nonzero(addr);
+      //printf("Calling cache_allocate for %08X\n", addr);
+      if (l1fits){
+	dl1->allocate(addr); // special function to allocate a cache line with all zero
+      }
+    }
+    dl1->write(addr, value);
+    sval = value;
+  }
+  // the evictions of a write may have dropped a zero copy of its own
+  // block further down
+  if (value != 0 && (rec->op == TR_WRITE || sval != value) && mp != 0 && mp->nonzero(addr) == 0){
+    mark_nonzero(addr);
+  }
+  lines++;
+  if (lines == snext){
+    st->sample(lines);
+    snext += sint;
+  }
+
+  // clear stats collected during warmup
+  if (lines == skip){
+    clearstats();
+  }
+  return sval;
+}
+
+template <i32 DATA, class OBS>
+void hierarchy_t<DATA, OBS>::clearstats(){
+  // the warmup ends an interval early, later ones count from zero
+  if (st != 0){
+    st->sample(lines);
+  }
+  for (i32 i = 0;i < nlevels;i++){
+    levels[i]->clearstats();
+  }
+  if (mp != 0){
+    mp->clearstats();
+  }
+  if (st != 0){
+    st->rebase();
+  }
+}
+
+template <i32 DATA, class OBS>
+void hierarchy_t<DATA, OBS>::stats(){
+  if (mp != 0){
+    mp->stats();
+  }
+  for (i32 i = 0;i < nlevels;i++){
+    levels[i]->stats();
+  }
+  sp->stats();
+}
+
+template class hierarchy_t<1>;
+template class hierarchy_t<0>;
+template class hierarchy_t<1, sim_observer>;
+template class hierarchy_t<0, sim_observer>;
@@ -0,0 +1,105 @@
+#ifndef HIER_H
+#define HIER_H
+
+#include "utils.h"
+#include "store.h"
+#include "tcache.h"
+#include "memmap.h"
+#include "trace.h"
+
+// cache hierarchy description, from a config file or a command line spec
+
+#define MAX_LEVELS 8
+#define MAX_CONFIGS MAX_READERS
+
+typedef struct level_cfg_t {
+  char name[16];
+  i32 sets;
+  i32 bsize;
+  i32 assoc;
+  i32 policy;
+} level_cfg;
+
+typedef struct hier_cfg_t {
+  i32 nlevels;
+  level_cfg levels[MAX_LEVELS];
+  i32 map_enable;
+  i32 map_psize;
+  i32 map_tlb;
+  i32 map_tlb_assoc; // 0 for fully associative
+  i32 map_tlb2; // 0 for 4 * map_tlb
+  i32 map_tlb2_assoc;
+  i32 mem_dedup; // merge identical memory pages
+} hier_cfg;
+
+// the original two-level setup: a 32-set 2-way L1 in front of the given
+// L2, 0 if the L2 is not a valid cache
+i32 hier_default(hier_cfg* cfg, i32 assoc, i32 sets, i32 bsize);
+// name:assoc:sets:bsize[:policy] levels separated by commas, L1 first
+i32 hier_parse_spec(hier_cfg* cfg, const char* spec);
+// one "level name assoc sets bsize [policy]" or
+// "map enable psize entries [assoc [l2-entries [l2-assoc]]]" line each,
+// '#' starts a comment
+i32 hier_parse_file(hier_cfg* cfg, const char* file);
+// one spec per line, appended to cfgs[*n..max), for sweeping many
+// hierarchies over a single pass of the trace
+i32 hier_parse_sweep(hier_cfg* cfgs, i32* n, i32 max, const char* file);
+void hier_print(hier_cfg* cfg);
+
+// a chain of tcache levels in front of the memory map and backing store,
+// driven by trace accesses. Without DATA the levels keep only which words
+// are nonzero, and a nonzero word read from them is assumed to hold the
+// trace's value; the counters match a DATA run unless that run finds a
+// nonzero word that differs from a nonzero trace value. The levels and
+// the map updates made here report their events to an OBS.
+
+template <i32 DATA, class OBS = no_observer>
+class hierarchy_t {
+  tcache_t<DATA, OBS>** levels;
+  char** names; // the levels' names, which the levels do not own
+  i32 nlevels;
+  mem_map* mp;
+  tmemory* sp;
+  i32 mixed; // some level's lines are not the map's blocks
+  i32 l1fits; // an L1 line lies within one map block
+  i32 mshift; // from an address to its map block
+  i32 mwords;
+  i64* mzero; // a zeroed map block
+  void mark_nonzero(i64 addr);
+  i64 lines;
+  i64 mismatches;
+  i64 conflicts; // reads of a nonzero word other than the trace's nonzero value
+  i64 skip;
+  stat_registry* st;
+  i64 snext; // accesses at the next interval sample
+  i64 sint;
+  OBS* obs;
+ public:
+  hierarchy_t(hier_cfg* cfg, i32 ofs);
+  // the levels, memory, map and observer; any stats file is closed
+  // without a final sample
+  ~hierarchy_t();
+  // the value a read found, 0 if the map knew the word was zero, or the
+  // value written
+  i64 access(const trace_rec* rec);
+  void clearstats();
+  void stats();
+  void set_skip(i64 n);
+  // sample every level's and the map's counters each interval accesses
+  // into file, as CSV or, with json set, JSON lines
+  i32 set_stats(const char* file, i64 interval, i32 json);
+  void close_stats();
+  // the observer all levels report to, to be set up before the run
+  OBS* observer();
+  tcache_t<DATA, OBS>* level(i32 n);
+  i64 get_lines();
+  i64 get_mismatches();
+  // always 0 without DATA, which cannot tell nonzero values apart; the
+  // counters of a tag-only run match a DATA run only if this is 0 there
+  i64 get_conflicts();
+};
+
+typedef hierarchy_t<1> hierarchy;
+typedef hierarchy_t<0> tag_hierarchy;
+
+#endif /* HIER_H */
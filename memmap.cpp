@@ -1,89 +1,185 @@
 #include "memmap.h"
+#include "simd.h"
 
-mem_map::mem_map(i32 enable, i32 ps, i32 bs, i32 cs, i32 ofs){
+static mm_cache* tlb_create(i32 n, i32 assoc){
+  mm_cache* t = new mm_cache();
+  assoc = (assoc == 0) ? n : assoc;
+  assert(n <= 65536 && n % assoc == 0 && pow2(n / assoc));
+  t->nents = n;
+  t->assoc = assoc;
+  t->nsets = n / assoc;
+  assert(t->nsets == 1 || assoc <= MAX_ASSOC);
+  t->entries = new map_entry*[n]();
+  t->tags = new i64[n];
+  for (i32 i = 0;i < n;i++){
+    t->tags[i] = TLB_NOTAG;
+  }
+  if (t->nsets == 1){
+    i32 size = 1;
+    while (size < 2 * n){
+      size <<= 1;
+    }
+    t->index = new int[size];
+    for (i32 i = 0;i < size;i++){
+      t->index[i] = -1;
+    }
+    t->imask = size - 1;
+  }
+  t->accs = 0;
+  t->hits = 0;
+  t->misses = 0;
+  t->zeros = 0;
+
+  // initialize LRU info, per set; way w starts out as if last used at
+  // time w, the order lru_init gives
+  if (t->nsets == 1){
+    t->used = new i64[n];
+    for (i32 i = 0;i < n;i++){
+      t->used[i] = i;
+    }
+    t->clock = n;
+  }else{
+    t->ages = new tlb_age[n];
+    for (i32 i = 0;i < t->nsets;i++){
+      lru_init(t->ages + i * assoc, assoc);
+    }
+  }
+  return t;
+}
+
+// the arrays a TLB was not made with are 0
+static void tlb_destroy(mm_cache* t){
+  delete[] t->entries;
+  delete[] t->tags;
+  delete[] t->ages;
+  delete[] t->used;
+  delete[] t->index;
+  delete t;
+}
+
+static inline i32 tlb_home(mm_cache* t, i64 tag){
+  return ((tag * 0x9E3779B97F4A7C15UL) >> 40) & t->imask;
+}
+
+// way holding tag, or -1
+static int tlb_find(mm_cache* t, i64 tag){
+  if (t->nsets == 1){
+    for (i32 i = tlb_home(t, tag);t->index[i] >= 0;i = (i + 1) & t->imask){
+      if (t->tags[t->index[i]] == tag){
+	return t->index[i];
+      }
+    }
+    return -1;
+  }
+  i32 base = (tag & (t->nsets - 1)) * t->assoc;
+  i64 m = simd_match64(t->tags + base, t->assoc, tag);
+  return (m == 0) ? -1 : base + (63 - __builtin_clzl(m));
+}
+
+// least recently used way of the set tag maps to
+static i32 tlb_victim(mm_cache* t, i64 tag){
+  if (t->nsets == 1){
+    i64 oldest = t->used[0];
+    i32 v = 0;
+    for (i32 i = 1;i < t->nents;i++){
+      if (t->used[i] < oldest){
+	oldest = t->used[i];
+	v = i;
+      }
+    }
+    return v;
+  }
+  i32 base = (tag & (t->nsets - 1)) * t->assoc;
+  return base + lru_victim(t->ages + base, t->assoc);
+}
+
+// put page e in way, replacing what it held
+static void tlb_fill(mm_cache* t, int way, map_entry* e){
+  if (t->nsets == 1){
+    i32 i, j;
+    if (t->tags[way] != TLB_NOTAG){
+      // take the old tag out, moving later entries of its probe run back
+      for (i = tlb_home(t, t->tags[way]);t->index[i] != way;i = (i + 1) & t->imask);
+      for (j = (i + 1) & t->imask;t->index[j] >= 0;j = (j + 1) & t->imask){
+	i32 k = tlb_home(t, t->tags[t->index[j]]);
+	if (((j - k) & t->imask) >= ((j - i) & t->imask)){
+	  t->index[i] = t->index[j];
+	  i = j;
+	}
+      }
+      t->index[i] = -1;
+    }
+    for (i = tlb_home(t, e->tag);t->index[i] >= 0;i = (i + 1) & t->imask);
+    t->index[i] = way;
+  }
+  t->entries[way] = e;
+  t->tags[way] = e->tag;
+}
+
+
+mem_map::mem_map(i32 enable, i32 ps, i32 bs, i32 cs, i32 ofs, i32 ca, i32 cs2, i32 ca2){
   // create the memory map;
   pshift = log2(ps) - ofs;
   bshift = log2(bs) - ofs;
   bsize = bs;
   psize = ps;
   bmask = (ps / bs) - 1;
-  nents = (1 << (22+ofs)) / (ps >> 10);
-  assert(pow2(nents));
   bwused = 0;
-  entries = new map_entry[nents];
-  for (i32 i=0;i<nents;i++){
-    entries[i].valid = 0; // entry is not valid
-    entries[i].zero = 0; // entry is zero
-    entries[i].tag = i;
-  }
+  lchunk = -1;
+  lentries = 0;
   enabled = enable;
 
-  // create the l1 map tlb
-  tlb = new mm_cache();
-  tlb->nents = cs;
-  tlb->entries = new map_entry*[cs];
-  tlb->accs = 0;
-  tlb->hits = 0;
-  tlb->misses = 0;
-  tlb->zeros = 0;
-
-  // initialize LRU info for l1 tlb
-  item* node = new item();
-  node->val = 0;
-  tlb->lru = node;
-  for (i32 i=1;i<tlb->nents;i++){
-    node->next = new item();
-    node->next->val = i;
-    node = node->next;
-  }
-
-  // create the l2 map tlb
-  tlb2 = new mm_cache();
-  tlb2->nents = cs << 2;
-  tlb2->entries = new map_entry*[cs << 2];
-  tlb2->accs = 0;
-  tlb2->hits = 0;
-  tlb2->misses = 0;
-  tlb2->zeros = 0;
-
-  // initialize LRU info for l1 tlb
-  node = new item();
-  node->val = 0;
-  tlb2->lru = node;
-  for (i32 i=1;i<tlb2->nents;i++){
-    node->next = new item();
-    node->next->val = i;
-    node = node->next;
-  }
-
+  // create the l1 and l2 map tlbs
+  tlb = tlb_create(cs, ca);
+  tlb2 = tlb_create(cs2 ? cs2 : (cs << 2), ca2);
 
   //printf("Initialized mem_map with %u TLB entries\n", tlb->nents);
 }
 
-i32 mem_map::lookup(i32 addr){
-  i32 hit, hitway, block, tag, zero;
+mem_map::~mem_map(){
+  tlb_destroy(tlb);
+  tlb_destroy(tlb2);
+  for (auto it = chunks.begin();it != chunks.end();++it){
+    delete[] it->second;
+  }
+}
 
-  tag = addr >> (pshift);
-  block = (addr >> bshift) & bmask;
-  hit = hitway = 0;
-
-  // check tags of tlb entries
-  for(i32 i=0;i<tlb->nents;i++){
-    if (tlb->entries[i] != 0){
-      if (tlb->entries[i]->tag == tag){
-	hit = 1;
-	hitway = i;
+// map entry of page tag, with its chunk made on first use
+map_entry* mem_map::entry(i64 tag){
+  i64 c = tag >> MAP_CHUNK_BITS;
+  if (c != lchunk){
+    map_entry*& ep = chunks[c];
+    if (ep == 0){
+      ep = new map_entry[MAP_CHUNK];
+      for (i32 i=0;i<MAP_CHUNK;i++){
+	ep[i].valid = 0; // entry is not valid
+	ep[i].dirty = 0;
+	ep[i].zero = 0; // entry is zero
+	ep[i].tag = (c << MAP_CHUNK_BITS) + i;
       }
     }
+    lchunk = c;
+    lentries = ep;
   }
+  return &(lentries[tag & (MAP_CHUNK - 1)]);
+}
+
+i32 mem_map::lookup(i64 addr){
+  i32 block, zero;
+  int hitway;
+  i64 tag;
+
+  tag = addr >> (pshift);
+  block = (addr >> bshift) & bmask;
+  hitway = tlb_find(tlb, tag);
 
   // update bookkeeping
-  if (hit == 1){
+  if (hitway >= 0){
     tlb->hits++;
   }else{
     tlb->misses++;
-    hitway = tlb->lru->val;
-    tlb->entries[hitway] = lookup2(addr); //&(entries[tag]);
+    hitway = tlb_victim(tlb, tag);
+    tlb_fill(tlb, hitway, lookup2(addr));
   }
   update_lru(tlb, hitway);
   tlb->accs++;
@@ -103,28 +199,19 @@ i32 mem_map::lookup(i32 addr){
   return zero;
 }
 
-map_entry* mem_map::lookup2(i32 addr){
-  i32 hit, hitway, tag;
+map_entry* mem_map::lookup2(i64 addr){
+  int hitway;
+  i64 tag;
   tag = addr >> (pshift);
-  hit = hitway = 0;
-
-  // check tags of tlb entries
-  for(i32 i=0;i<tlb2->nents;i++){
-    if (tlb2->entries[i] != 0){
-      if (tlb2->entries[i]->tag == tag){
-	hit = 1;
-	hitway = i;
-      }
-    }
-  }
+  hitway = tlb_find(tlb2, tag);
 
   // update bookkeeping
-  if (hit == 1){
+  if (hitway >= 0){
     tlb2->hits++;
   }else{
     tlb2->misses++;
-    hitway = tlb2->lru->val;
-    tlb2->entries[hitway] = &(entries[tag]);
+    hitway = tlb_victim(tlb2, tag);
+    tlb_fill(tlb2, hitway, entry(tag));
     bwused += 8 + (enabled << 2);
   }
   update_lru(tlb2, hitway);
@@ -136,29 +223,32 @@ map_entry* mem_map::lookup2(i32 addr){
   return (tlb2->entries[hitway]);
 }
 
-void mem_map::update_block(i32 addr, i32 zero){
-  i32 block, hit, hitway, tag;
+i32 mem_map::nonzero(i64 addr){
+  if (enabled == 0){
+    return 1;
+  }
+  return (entry(addr >> pshift)->zero >> ((addr >> bshift) & bmask)) & 1;
+}
+
+i32 mem_map::get_enabled(){
+  return enabled;
+}
+
+void mem_map::update_block(i64 addr, i32 zero){
+  i32 block;
+  int hitway;
+  i64 tag;
   tag = addr >> (pshift);
-  hit = hitway = 0;
   block = (addr >> bshift) & bmask;
-
-  // check tags of tlb entries
-  for(i32 i=0;i<tlb2->nents;i++){
-    if (tlb2->entries[i] != 0){
-      if (tlb2->entries[i]->tag == tag){
-	hit = 1;
-	hitway = i;
-      }
-    }
-  }
+  hitway = tlb_find(tlb2, tag);
 
   // update bookkeeping
-  if (hit == 1){
+  if (hitway >= 0){
     tlb2->hits++;
   }else{
     tlb2->misses++;
-    hitway = tlb2->lru->val;
-    tlb2->entries[hitway] = &(entries[tag]);
+    hitway = tlb_victim(tlb2, tag);
+    tlb_fill(tlb2, hitway, entry(tag));
     if (tlb2->entries[hitway]->dirty == 0){
       bwused += 8 + (enabled << 2);
     }else{
@@ -169,70 +259,52 @@ void mem_map::update_block(i32 addr, i32 zero){
   update_lru(tlb2, hitway);
 
   if (zero == 1){ // update memory and tlb2 to avoid writeback
-    entries[tag].zero = (entries[tag].zero) | (1 << block);
+    tlb2->entries[hitway]->zero |= (1 << block);
   }else{
-    entries[tag].zero = (entries[tag].zero) & (~(1 << block));
+    tlb2->entries[hitway]->zero &= (~(1 << block));
   }
   tlb2->entries[hitway]->dirty = 1;
   tlb2->accs++;
 }
 
 void mem_map::update_lru(mm_cache * tlb, i32 hitway){
-  item * hitnode;
-  item * node = tlb->lru;
-  item * temp;
-
-  /*temp = tlb->lru;
-  printf("before: way %d referenced, (%d,", hitway, teval);
-  while (tenext != 0){
-    temp = tenext;
-    printf("%d,", teval);
-  }
-  printf(")\n");*/
-
-  if (node->next == 0){
-    // direct-mapped cache
+  if (tlb->nsets == 1){
+    tlb->used[hitway] = tlb->clock++;
     return;
   }
-  
-  if (node->val == hitway){
-    hitnode = node;
-    tlb->lru = node->next;
-    while (node->next != 0){
-      node = node->next;
-    }
-  }else{
-    while (node->next != 0){
-      if (node->next->val == hitway){
-	hitnode = node->next;
-	node->next = hitnode->next;
-      }else{
-	node = node->next;
-      }
-    }
-  }
-  node->next = hitnode;
-  hitnode->next = 0;
-
-  /*temp = tlb->lru;
-  printf("after: way %d referenced, (%d,", hitway, teval);
-  while (tenext != 0){
-    temp = tenext;
-    printf("%d,", teval);
-  }
-  printf(")\n");*/
+  i32 base = hitway - hitway % tlb->assoc;
+  lru_touch(tlb->ages + base, tlb->assoc, hitway - base);
 }
 
 void mem_map::stats(){
-  printf("%d entry L1 TLB stats\n", tlb->nents);
-  printf("%d accesses, %d hits, %d misses, %d avoided accesses\n", tlb->accs, tlb->hits, tlb->misses, tlb->zeros);
+  if (tlb->nsets == 1){
+    printf("%d entry L1 TLB stats\n", tlb->nents);
+  }else{
+    printf("%d entry %d-way L1 TLB stats\n", tlb->nents, tlb->assoc);
+  }
+  printf("%lu accesses, %lu hits, %lu misses, %lu avoided accesses\n", tlb->accs, tlb->hits, tlb->misses, tlb->zeros);
   printf("miss rate: %1.8f\n", (((double)tlb->misses)/(tlb->accs)));
-  printf("%d entry L2 TLB stats\n", tlb2->nents);
-  printf("%d accesses, %d hits, %d misses\n", tlb2->accs, tlb2->hits, tlb2->misses);
+  if (tlb2->nsets == 1){
+    printf("%d entry L2 TLB stats\n", tlb2->nents);
+  }else{
+    printf("%d entry %d-way L2 TLB stats\n", tlb2->nents, tlb2->assoc);
+  }
+  printf("%lu accesses, %lu hits, %lu misses\n", tlb2->accs, tlb2->hits, tlb2->misses);
   printf("miss rate: %1.8f\n", (((double)tlb2->misses)/(tlb2->accs)));
   printf("bandwidth used: %lu KB\n", (bwused >> 10));
 }
 
+void mem_map::reg_stats(stat_registry* r){
+  r->add("map.tlb", "accs", &(tlb->accs));
+  r->add("map.tlb", "hits", &(tlb->hits));
+  r->add("map.tlb", "misses", &(tlb->misses));
+  r->add("map.tlb", "zeros", &(tlb->zeros));
+  r->add("map.tlb2", "accs", &(tlb2->accs));
+  r->add("map.tlb2", "hits", &(tlb2->hits));
+  r->add("map.tlb2", "misses", &(tlb2->misses));
+  r->add("map", "bwused", &bwused);
+}
+
 mm_cache* mem_map::get_tlb(){
   return tlb;
 }
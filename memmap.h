@@ -4,33 +4,58 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <unordered_map>
 #include "utils.h"
+#include "stats.h"
 
 typedef struct ent_struct {
   i32 valid;
   i32 dirty;
   i32 zero; // makeshift bit vector for zero
-  i32 tag;
+  i64 tag; // page number
 } map_entry;
 
+// a map TLB of nsets sets of assoc ways, LRU within each set. The tags
+// of the ways are kept beside the entry pointers so a lookup reads no
+// entries. A fully associative TLB (one set) finds the way of a tag
+// through an open-addressed hash index instead of comparing all of them,
+// and stamps each way with the time of its last use instead of keeping
+// ages, so a hit costs one store and only a miss looks at every way.
+
+#define TLB_NOTAG (~0UL) // tag of an empty way, no page number is this large
+
 typedef struct map_cache_struct {
   map_entry** entries;
-  item* lru;
+  i64* tags;
+  tlb_age* ages;
+  i64* used; // time of each way's last use when fully associative
+  i64 clock;
   i32 nents;
+  i32 assoc;
+  i32 nsets;
+  int* index; // way of each tag when fully associative, -1 for empty slots
+  i32 imask;
 
-  i32 accs;
-  i32 hits;
-  i32 misses;
-  i32 zeros;
+  i64 accs;
+  i64 hits;
+  i64 misses;
+  i64 zeros;
 } mm_cache;
 
+#define MAP_CHUNK_BITS 10
+#define MAP_CHUNK (1 << MAP_CHUNK_BITS)
+
 // Core 2 had a 16 entry L1 TLB and 256 entry L2 TLB
 // Nehalem had a 64 entry L1 TLB and 512 entry L2 TLB
 
 class mem_map {
   mm_cache* tlb; // L1 tlb
   mm_cache* tlb2; // L2 tlb - updated on eviction
-  map_entry * entries;
+  // entries are made MAP_CHUNK pages at a time, the first time a page of
+  // the chunk is looked up, and never move, so TLBs can point at them
+  std::unordered_map<i64, map_entry*> chunks;
+  i64 lchunk; // chunk of the last entry made or found
+  map_entry* lentries;
   
   i32 pshift;
   i32 bshift;
@@ -38,19 +63,29 @@ class mem_map {
   i32 enabled;
   i32 os;
 
-  i32 nents;
   i32 psize;
   i32 bsize;
   i64 bwused;
+  map_entry* entry(i64 tag);
 
  public:
-  mem_map(i32 enable, i32 ps, i32 bs, i32 cs, i32 ofs);
-  i32 lookup(i32 addr);
-  map_entry* lookup2(i32 addr);
-  void update_block(i32 addr, i32 zero);
+  // cs entries in the L1 TLB and cs2 (4 * cs if 0) in the L2 TLB, with ca
+  // and ca2 ways per set; 0 ways means fully associative
+  mem_map(i32 enable, i32 ps, i32 bs, i32 cs, i32 ofs, i32 ca = 0, i32 cs2 = 0, i32 ca2 = 0);
+  ~mem_map();
+  i32 lookup(i64 addr);
+  map_entry* lookup2(i64 addr);
+  // 0 if the map holds the block of addr as zero, 1 otherwise; a peek
+  // for the levels below an access that looked the page up, so no TLB
+  // access is counted
+  i32 nonzero(i64 addr);
+  i32 get_enabled();
+  void update_block(i64 addr, i32 zero);
   void update_lru(mm_cache* tlb, i32 hitway);
   void stats();
   void clearstats();
+  // TLB and bandwidth counters, as map.tlb.*, map.tlb2.* and map.bwused
+  void reg_stats(stat_registry* r);
   mm_cache* get_tlb();
 };
 
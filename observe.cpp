@@ -0,0 +1,128 @@
+#include "observe.h"
+#include <string.h>
+#include <assert.h>
+
+taint_observer::taint_observer(){
+  tlog = 0;
+  nlevels = 0;
+}
+
+void taint_observer::attach(i32 lv, const char* name, i32 /*nsets*/, i32 /*bshift*/){
+  assert(lv < OBS_MAX_LEVELS);
+  names[lv] = name;
+  nlevels = (lv >= nlevels) ? lv + 1 : nlevels;
+}
+
+i32 taint_observer::open_log(const char* file){
+  tlog = new event_log();
+  if (tlog->open(file, names, nlevels) == 0){
+    delete tlog;
+    tlog = 0;
+    return 0;
+  }
+  return 1;
+}
+
+i32 taint_observer::close(){
+  if (tlog != 0){
+    tlog->close();
+    delete tlog;
+    tlog = 0;
+  }
+  return 1;
+}
+
+value_observer::value_observer(){
+  vs = 0;
+}
+
+i32 value_observer::open_trace(const char* app, i32 comp, i64 max_recs, i64 max_bytes){
+  vs = new value_sink();
+  if (vs->open(app, comp, max_recs, max_bytes) == 0){
+    delete vs;
+    vs = 0;
+    return 0;
+  }
+  return 1;
+}
+
+i32 value_observer::close(){
+  i32 ok = 1;
+  if (vs != 0){
+    vs->close();
+    ok = !vs->failed();
+    delete vs;
+    vs = 0;
+  }
+  return ok;
+}
+
+set_observer::set_observer(){
+  nlevels = 0;
+  for (i32 i = 0;i < OBS_MAX_LEVELS;i++){
+    acount[i] = mcount[i] = 0;
+  }
+}
+
+set_observer::~set_observer(){
+  for (i32 i = 0;i < OBS_MAX_LEVELS;i++){
+    free(acount[i]);
+    free(mcount[i]);
+  }
+}
+
+void set_observer::attach(i32 lv, const char* /*name*/, i32 ns, i32 /*bshift*/){
+  assert(lv < OBS_MAX_LEVELS);
+  nsets[lv] = ns;
+  nlevels = (lv >= nlevels) ? lv + 1 : nlevels;
+}
+
+void set_observer::track_sets(){
+  for (i32 i = 0;i < nlevels;i++){
+    acount[i] = (i64*)calloc(nsets[i], sizeof(i64));
+    mcount[i] = (i64*)calloc(nsets[i], sizeof(i64));
+  }
+}
+
+void set_observer::clearstats(i32 lv){
+  if (acount[lv] == 0){
+    return;
+  }
+  memset(acount[lv], 0, nsets[lv] * sizeof(i64));
+  memset(mcount[lv], 0, nsets[lv] * sizeof(i64));
+}
+
+void set_observer::stats(i32 lv){
+  if (acount[lv] == 0){
+    return;
+  }
+  for (i32 i = 0;i < nsets[lv];i++){
+    printf("Set %u, Accesses %lu, Misses %lu\n", i, acount[lv][i], mcount[lv][i]);
+  }
+}
+
+watch_observer::watch_observer(){
+  waddr = 0;
+  on = 0;
+  nlevels = 0;
+}
+
+void watch_observer::attach(i32 lv, const char* name, i32 /*nsets*/, i32 bshift){
+  assert(lv < OBS_MAX_LEVELS);
+  names[lv] = name;
+  shifts[lv] = bshift;
+  nlevels = (lv >= nlevels) ? lv + 1 : nlevels;
+}
+
+void watch_observer::watch(i64 addr){
+  waddr = addr;
+  on = 1;
+}
+
+void watch_observer::print(i32 lv, const char* what, int set, i64 addr){
+  if (set >= 0){
+    printf("%s %s: set %d, addr %lx\n", names[lv], what, set, addr);
+  }else{
+    printf("%s %s: addr %lx\n", names[lv], what, addr);
+  }
+}
@@ -0,0 +1,197 @@
+#ifndef OBSERVE_H
+#define OBSERVE_H
+
+#include "utils.h"
+#include "evlog.h"
+
+// cache events: the caches and the hierarchy take an observer type as a
+// template parameter and report every event to it. no_observer's hooks
+// are empty, so a hierarchy built with it compiles to the bare simulator,
+// and observers<A, B, ...> passes each event on to all of A, B, ... in
+// turn. Levels are named by their position, 0 for L1, and lines by the
+// address that brought them in; a line is n words long, 0 in tag-only
+// caches, which keep no values.
+
+#define OBS_MAX_LEVELS 16
+
+struct no_observer {
+  // level lv has nsets sets and addr >> bshift is the block of addr there
+  void attach(i32 /*lv*/, const char* /*name*/, i32 /*nsets*/, i32 /*bshift*/){}
+  // a read or write of addr found its line in set set of level lv
+  void hit(i32 /*lv*/, i32 /*set*/, i64 /*addr*/){}
+  void miss(i32 /*lv*/, i32 /*set*/, i64 /*addr*/){}
+  // the line of addr leaves level lv to make room
+  void evict(i32 /*lv*/, i32 /*set*/, i64 /*addr*/, i32 /*dirty*/){}
+  // a dirty line goes to the next level or to memory
+  void writeback(i32 /*lv*/, i64 /*addr*/, const i64* /*line*/, i32 /*n*/){}
+  // a line was filled from the next level, or from memory if mem is set
+  void refill(i32 /*lv*/, i64 /*addr*/, const i64* /*line*/, i32 /*n*/, i32 /*mem*/){}
+  // the map recorded the block of addr as zero or nonzero
+  void map_update(i64 /*addr*/, i32 /*nonzero*/){}
+  // level lv's statistics were reset, at the end of the warmup
+  void clearstats(i32 /*lv*/){}
+  // after level lv's statistics have been printed
+  void stats(i32 /*lv*/){}
+  // the run is over, output has to be written out; 0 if some could not be
+  i32 close(){ return 1; }
+};
+
+template <class... O>
+struct observers : O... {
+  void attach(i32 lv, const char* name, i32 nsets, i32 bshift){
+    (O::attach(lv, name, nsets, bshift), ...);
+  }
+  inline void hit(i32 lv, i32 set, i64 addr){
+    (O::hit(lv, set, addr), ...);
+  }
+  inline void miss(i32 lv, i32 set, i64 addr){
+    (O::miss(lv, set, addr), ...);
+  }
+  inline void evict(i32 lv, i32 set, i64 addr, i32 dirty){
+    (O::evict(lv, set, addr, dirty), ...);
+  }
+  inline void writeback(i32 lv, i64 addr, const i64* line, i32 n){
+    (O::writeback(lv, addr, line, n), ...);
+  }
+  inline void refill(i32 lv, i64 addr, const i64* line, i32 n, i32 mem){
+    (O::refill(lv, addr, line, n, mem), ...);
+  }
+  inline void map_update(i64 addr, i32 nonzero){
+    (O::map_update(addr, nonzero), ...);
+  }
+  void clearstats(i32 lv){
+    (O::clearstats(lv), ...);
+  }
+  void stats(i32 lv){
+    (O::stats(lv), ...);
+  }
+  // every observer is closed, whether or not another failed
+  i32 close(){
+    return (O::close() & ...);
+  }
+};
+
+// the level each access hit in and every fill from memory, written to an
+// event_log (<app>-taint.evl)
+class taint_observer : public no_observer {
+  event_log* tlog;
+  const char* names[OBS_MAX_LEVELS];
+  i32 nlevels;
+ public:
+  taint_observer();
+  void attach(i32 lv, const char* name, i32 nsets, i32 bshift);
+  // log to file from now on, with the names of the attached levels
+  i32 open_log(const char* file);
+  inline void hit(i32 lv, i32 /*set*/, i64 /*addr*/){
+    if (tlog != 0){
+      tlog->event(lv);
+    }
+  }
+  inline void refill(i32 /*lv*/, i64 /*addr*/, const i64* /*line*/, i32 /*n*/, i32 mem){
+    if (mem && tlog != 0){
+      tlog->event(EV_MEM);
+    }
+  }
+  i32 close();
+};
+
+// the nonzero values of every line filled from memory, written to a
+// value_sink (<app>_l2trace<N>.vtr)
+class value_observer : public no_observer {
+  value_sink* vs;
+ public:
+  value_observer();
+  i32 open_trace(const char* app, i32 comp, i64 max_recs, i64 max_bytes);
+  inline void refill(i32 /*lv*/, i64 /*addr*/, const i64* line, i32 n, i32 mem){
+    if (mem && vs != 0){
+      for (i32 i = 0;i < n;i++){
+	if (line[i] != 0){
+	  vs->put(line[i]);
+	}
+      }
+    }
+  }
+  i32 close();
+};
+
+// accesses and misses of every set, printed with each level's statistics
+class set_observer : public no_observer {
+  i64* acount[OBS_MAX_LEVELS];
+  i64* mcount[OBS_MAX_LEVELS];
+  i32 nsets[OBS_MAX_LEVELS];
+  i32 nlevels;
+ public:
+  set_observer();
+  ~set_observer();
+  void attach(i32 lv, const char* name, i32 ns, i32 bshift);
+  // count the sets of the attached levels from now on
+  void track_sets();
+  inline void hit(i32 lv, i32 set, i64 /*addr*/){
+    if (acount[lv] != 0){
+      acount[lv][set]++;
+    }
+  }
+  inline void miss(i32 lv, i32 set, i64 /*addr*/){
+    if (acount[lv] != 0){
+      acount[lv][set]++;
+      mcount[lv][set]++;
+    }
+  }
+  // the counts restart with the level's other statistics
+  void clearstats(i32 lv);
+  void stats(i32 lv);
+};
+
+// every event of the lines holding one address, printed as it happens
+class watch_observer : public no_observer {
+  i64 waddr;
+  i32 on;
+  const char* names[OBS_MAX_LEVELS];
+  i32 shifts[OBS_MAX_LEVELS];
+  i32 nlevels;
+  inline i32 watched(i32 lv, i64 addr){
+    return on && (addr >> shifts[lv]) == (waddr >> shifts[lv]);
+  }
+  void print(i32 lv, const char* what, int set, i64 addr); // set -1 if none
+ public:
+  watch_observer();
+  void attach(i32 lv, const char* name, i32 nsets, i32 bshift);
+  void watch(i64 addr);
+  inline void hit(i32 lv, i32 set, i64 addr){
+    if (watched(lv, addr)){
+      print(lv, "hit", set, addr);
+    }
+  }
+  inline void miss(i32 lv, i32 set, i64 addr){
+    if (watched(lv, addr)){
+      print(lv, "miss", set, addr);
+    }
+  }
+  inline void evict(i32 lv, i32 set, i64 addr, i32 dirty){
+    if (watched(lv, addr)){
+      print(lv, dirty ? "evict dirty" : "evict", set, addr);
+    }
+  }
+  inline void writeback(i32 lv, i64 addr, const i64* /*line*/, i32 /*n*/){
+    if (watched(lv, addr)){
+      print(lv, "writeback", -1, addr);
+    }
+  }
+  inline void refill(i32 lv, i64 addr, const i64* /*line*/, i32 /*n*/, i32 mem){
+    if (watched(lv, addr)){
+      print(lv, mem ? "refill from memory" : "refill", -1, addr);
+    }
+  }
+  // the map works at the last level's block size
+  inline void map_update(i64 addr, i32 nonzero){
+    if (nlevels > 0 && watched(nlevels - 1, addr)){
+      print(nlevels - 1, nonzero ? "map nonzero" : "map zero", -1, addr);
+    }
+  }
+};
+
+// what cache_sim can turn on at run time; a run with none of them uses
+// no_observer
+typedef observers<taint_observer, value_observer, set_observer, watch_observer> sim_observer;
+
+#endif /* OBSERVE_H */
@@ -0,0 +1,446 @@
+#include "refsim.h"
+#include <string.h>
+
+ref_memory::ref_memory(i32 ofs){
+  ishift = 3 - ofs;
+}
+
+void ref_memory::read_block(i64 addr, i64* out, i32 n){
+  for (i32 i = 0;i < n;i++){
+    auto it = words.find((addr >> ishift) + i);
+    out[i] = (it == words.end()) ? 0 : it->second;
+  }
+}
+
+void ref_memory::write_block(i64 addr, const i64* in, i32 n){
+  for (i32 i = 0;i < n;i++){
+    if (in[i] == 0){
+      words.erase((addr >> ishift) + i);
+    }else{
+      words[(addr >> ishift) + i] = in[i];
+    }
+  }
+}
+
+ref_map::ref_map(i32 enable, i32 ps, i32 bs, i32 ofs){
+  enabled = enable;
+  pshift = log2(ps) - ofs;
+  bshift = log2(bs) - ofs;
+  bmask = (ps / bs) - 1;
+}
+
+i32 ref_map::lookup(i64 addr){
+  if (enabled == 0){
+    return 1;
+  }
+  auto it = pages.find(addr >> pshift);
+  i32 bits = (it == pages.end()) ? 0 : it->second;
+  return (bits >> (((addr >> bshift) & bmask) & 31)) & 1;
+}
+
+i32 ref_map::get_enabled(){
+  return enabled;
+}
+
+void ref_map::update_block(i64 addr, i32 nonzero){
+  i32& bits = pages[addr >> pshift];
+  i32 bit = 1U << (((addr >> bshift) & bmask) & 31);
+  bits = nonzero ? (bits | bit) : (bits & ~bit);
+}
+
+ref_cache::ref_cache(i32 ns, i32 bs, i32 as, i32 pol, i32 ofs){
+  nsets = ns;
+  assoc = as;
+  bsize = bs;
+  bvals = bs >> 3;
+  bshift = log2(bs) - ofs;
+  ishift = log2(ns);
+  policy = pol;
+  rstate = 0x9E3779B97F4A7C15UL;
+  next_level = 0;
+  prev_level = 0;
+  mem = 0;
+  map = 0;
+  accs = hits = misses = writebacks = allocs = bwused = 0;
+  refills = zrefills = zwritebacks = zsaved = 0;
+
+  // way w starts out as if last used at time w, so way 0 goes first
+  lines = new ref_line[(i64) ns * as];
+  data = new i64[(i64) ns * as * bvals]();
+  for (i64 i = 0;i < (i64) ns * as;i++){
+    lines[i].tag = 0;
+    lines[i].valid = 0;
+    lines[i].dirty = 0;
+    lines[i].used = i % as;
+    lines[i].words = data + i * bvals;
+  }
+  clock = as;
+}
+
+ref_cache::~ref_cache(){
+  delete[] lines;
+  delete[] data;
+}
+
+ref_line* ref_cache::set_of(i64 addr){
+  return lines + ((addr >> bshift) & (nsets - 1)) * assoc;
+}
+
+// the line holding addr, or 0; the highest way if there were two
+ref_line* ref_cache::find(i64 addr){
+  ref_line* set = set_of(addr);
+  ref_line* lp = 0;
+  for (i32 w = 0;w < assoc;w++){
+    if (set[w].valid && set[w].tag == (addr >> (bshift + ishift))){
+      lp = &(set[w]);
+    }
+  }
+  return lp;
+}
+
+ref_line* ref_cache::victim(ref_line* set){
+  if (policy == POL_RANDOM){
+    rstate ^= rstate << 13;
+    rstate ^= rstate >> 7;
+    rstate ^= rstate << 17;
+    return &(set[rstate % assoc]);
+  }
+  ref_line* lp = set;
+  for (i32 w = 1;w < assoc;w++){
+    if (set[w].used < lp->used){
+      lp = &(set[w]);
+    }
+  }
+  return lp;
+}
+
+// LRU orders lines by use, FIFO by fill
+void ref_cache::use(ref_line* lp, i32 hit){
+  if (policy == POL_LRU || (policy == POL_FIFO && hit == 0)){
+    lp->used = clock++;
+  }
+}
+
+i64 ref_cache::line_addr(ref_line* lp){
+  i64 index = ((lp - lines) / assoc);
+  return (lp->tag << (ishift + bshift)) + (index << bshift);
+}
+
+i32 ref_cache::word(i64 addr){
+  return (addr >> 2) & (bvals - 1);
+}
+
+i32 ref_cache::line_zero(const ref_line* lp){
+  for (i32 i = 0;i < bvals;i++){
+    if (lp->words[i] != 0){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+i32 ref_cache::held_above(i64 addr, i32 n){
+  for (ref_cache* cp = prev_level;cp != 0;cp = cp->prev_level){
+    for (i32 i = 0;i < n;i++){
+      ref_line* lp = cp->find(addr + (i << 2));
+      if (lp != 0 && lp->words[cp->word(addr + (i << 2))] != 0){
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// make room in lp for addr: a dirty line is written back, after its
+// replacement's line in the next level is touched if lock is set
+void ref_cache::evict(ref_line* lp, i32 lock, i64 addr){
+  if (lp->valid && lp->dirty){
+    if (lock && next_level != 0){
+      next_level->touch(addr);
+    }
+    writeback(lp);
+  }
+}
+
+void ref_cache::writeback(ref_line* lp){
+  i64 addr = line_addr(lp);
+  i32 dirty = lp->dirty;
+  i32 allzero = line_zero(lp);
+  i32 nonzero = 0;
+
+  zwritebacks += allzero;
+  if (next_level != 0){
+    i32 n = (bvals <= next_level->bvals) ? bvals : next_level->bvals;
+    for (i32 i = 0;i < bvals;i += n){
+      next_level->copy(addr + (i << 2), lp->words, i, n, dirty);
+    }
+    bwused += bsize;
+  }
+  // the map records a zero line instead of memory storing it, unless a
+  // level above still holds nonzero words of it
+  if (map != 0 && dirty){
+    nonzero = !allzero || (map->get_enabled() && held_above(addr, bvals));
+    if (!nonzero){
+      map->update_block(addr, 0);
+      zsaved += (mem != 0) ? bsize : 0;
+    }
+  }
+  if (mem != 0 && (nonzero || map == 0)){
+    mem->write_block(addr & (~0UL << bshift), lp->words, bvals);
+    bwused += bsize;
+  }
+  lp->dirty = 0;
+  writebacks++;
+}
+
+void ref_cache::refill(ref_line* lp, i64 addr){
+  i64 base = addr & (~0UL << bshift);
+
+  lp->tag = addr >> (bshift + ishift);
+  lp->valid = 1;
+  lp->dirty = 0;
+  if (next_level != 0){
+    i32 n = (bvals < next_level->bvals) ? bvals : next_level->bvals;
+    for (i32 i = 0;i < bvals;i += n){
+      next_level->read_block(base + (i << 2), lp->words, i, n);
+    }
+    bwused += bsize;
+  }else if (map != 0 && map->lookup(addr) == 0){
+    // memory's copy of a block the map holds as zero is stale
+    memset(lp->words, 0, bvals * sizeof(i64));
+  }else if (mem != 0){
+    mem->read_block(base, lp->words, bvals);
+    bwused += bsize;
+  }
+  refills++;
+  zrefills += line_zero(lp);
+}
+
+ref_line* ref_cache::fetch(i64 addr){
+  ref_line* lp = find(addr);
+  i32 hit = (lp != 0);
+
+  if (hit){
+    hits++;
+  }else{
+    misses++;
+    lp = victim(set_of(addr));
+    evict(lp, 1, addr);
+    refill(lp, addr);
+  }
+  use(lp, hit);
+  accs++;
+  return lp;
+}
+
+i64 ref_cache::read(i64 addr){
+  return fetch(addr)->words[word(addr)];
+}
+
+void ref_cache::read_block(i64 addr, i64* out, i32 ofs, i32 n){
+  ref_line* lp = fetch(addr);
+  memcpy(out + ofs, lp->words + word(addr), n * sizeof(i64));
+}
+
+void ref_cache::write(i64 addr, i64 data){
+  ref_line* lp = fetch(addr);
+  lp->words[word(addr)] = data;
+  lp->dirty = 1;
+}
+
+// the line of addr, zero filled on a miss
+void ref_cache::allocate(i64 addr){
+  ref_line* lp = find(addr);
+  i32 hit = (lp != 0);
+
+  hits += hit;
+  misses += !hit;
+  accs++;
+  if (!hit){
+    lp = victim(set_of(addr));
+    evict(lp, 0, addr);
+    lp->tag = addr >> (bshift + ishift);
+    lp->valid = 1;
+    lp->dirty = 0;
+    memset(lp->words, 0, bvals * sizeof(i64));
+  }
+  use(lp, hit);
+  allocs++;
+}
+
+void ref_cache::touch(i64 addr){
+  ref_line* lp = find(addr);
+  if (lp != 0){
+    use(lp, 1);
+  }
+}
+
+// n words of a line written back from the level above, from word ofs of in
+void ref_cache::copy(i64 addr, const i64* in, i32 ofs, i32 n, i32 dirty){
+  ref_line* lp = find(addr);
+  i32 hit = (lp != 0);
+  i32 off = 0;
+
+  if (!hit){
+    lp = victim(set_of(addr));
+    evict(lp, 0, addr);
+  }
+  if (n < bvals){
+    if (!hit){
+      refill(lp, addr);
+    }
+    off = word(addr);
+    lp->dirty |= dirty;
+  }else{
+    lp->dirty = dirty;
+  }
+  lp->tag = addr >> (bshift + ishift);
+  lp->valid = 1;
+  memcpy(lp->words + off, in + ofs, n * sizeof(i64));
+  use(lp, hit);
+}
+
+void ref_cache::reg_stats(stat_registry* r, const char* name){
+  r->add(name, "accs", &accs);
+  r->add(name, "hits", &hits);
+  r->add(name, "misses", &misses);
+  r->add(name, "writebacks", &writebacks);
+  r->add(name, "allocs", &allocs);
+  r->add(name, "bwused", &bwused);
+  r->add(name, "refills", &refills);
+  r->add(name, "zrefills", &zrefills);
+  r->add(name, "zwritebacks", &zwritebacks);
+  r->add(name, "zsaved", &zsaved);
+}
+
+void ref_cache::set_next(ref_cache* cp){
+  next_level = cp;
+  cp->prev_level = this;
+}
+
+void ref_cache::set_mem(ref_memory* mp){
+  mem = mp;
+}
+
+void ref_cache::set_map(ref_map* mp){
+  map = mp;
+}
+
+i64 ref_cache::get_accs(){
+  return accs;
+}
+
+i64 ref_cache::get_hits(){
+  return hits;
+}
+
+void ref_cache::set_accs(i64 num){
+  accs = num;
+}
+
+void ref_cache::set_hits(i64 num){
+  hits = num;
+}
+
+ref_hierarchy::ref_hierarchy(hier_cfg* cfg, i32 ofs){
+  nlevels = cfg->nlevels;
+  levels = new ref_cache*[nlevels];
+  for (i32 i = 0;i < nlevels;i++){
+    level_cfg* lp = &(cfg->levels[i]);
+    levels[i] = new ref_cache(lp->sets, lp->bsize, lp->assoc, lp->policy, ofs);
+    if (i > 0){
+      levels[i-1]->set_next(levels[i]);
+    }
+  }
+  mp = new ref_map(cfg->map_enable, cfg->map_psize, cfg->levels[nlevels-1].bsize, ofs);
+  sp = new ref_memory(ofs);
+  levels[nlevels-1]->set_mem(sp);
+  levels[nlevels-1]->set_map(mp);
+  mixed = 0;
+  for (i32 i = 0;i < nlevels;i++){
+    mixed |= (cfg->levels[i].bsize != cfg->levels[nlevels-1].bsize);
+  }
+  l1fits = (cfg->levels[0].bsize <= cfg->levels[nlevels-1].bsize);
+  mshift = log2(cfg->levels[nlevels-1].bsize) - ofs;
+  mwords = cfg->levels[nlevels-1].bsize >> 3;
+  mismatches = 0;
+}
+
+ref_hierarchy::~ref_hierarchy(){
+  for (i32 i = 0;i < nlevels;i++){
+    delete levels[i];
+  }
+  delete[] levels;
+  delete mp;
+  delete sp;
+}
+
+// with lines of other sizes than the map's blocks, memory's stale copy of
+// a block that was zero is zeroed before lines are merged into it
+void ref_hierarchy::mark_nonzero(i64 addr){
+  mp->update_block(addr, 1);
+  if (mixed){
+    i64* zero = new i64[mwords]();
+    sp->write_block(addr & (~0UL << mshift), zero, mwords);
+    delete[] zero;
+  }
+}
+
+i64 ref_hierarchy::access(const trace_rec* rec){
+  ref_cache* dl1 = levels[0];
+  i64 addr = rec->addr;
+  i64 value = rec->value;
+  i32 nonzero = mp->lookup(addr);
+  i64 sval;
+
+  if (rec->op == TR_READ){
+    sval = nonzero ? dl1->read(addr) : 0;
+    if (sval != value){
+      // the trace's value is written in, and the read and write count
+      // as one hit
+      if (!nonzero){
+	// an L1 line larger than the block is not known to be zero
+	mark_nonzero(addr);
+	if (l1fits){
+	  dl1->allocate(addr);
+	  dl1->write(addr, value);
+	  dl1->set_accs(dl1->get_accs() - 2);
+	  dl1->set_hits(dl1->get_hits() - 2);
+	}else{
+	  dl1->write(addr, value);
+	  dl1->set_accs(dl1->get_accs() - 1);
+	  dl1->set_hits(dl1->get_hits() - 1);
+	}
+	mismatches++;
+      }else{
+	dl1->write(addr, value);
+	dl1->set_accs(dl1->get_accs() - 1);
+	dl1->set_hits(dl1->get_hits() - 1);
+      }
+    }
+  }else{
+    if (!nonzero){
+      mark_nonzero(addr);
+      if (l1fits){
+	dl1->allocate(addr);
+      }
+    }
+    dl1->write(addr, value);
+    sval = value;
+  }
+  // the write's evictions may have dropped a zero copy of its block
+  if (value != 0 && (rec->op == TR_WRITE || sval != value) && mp->lookup(addr) == 0){
+    mark_nonzero(addr);
+  }
+  return sval;
+}
+
+void ref_hierarchy::reg_stats(stat_registry* r, hier_cfg* cfg){
+  for (i32 i = 0;i < nlevels;i++){
+    levels[i]->reg_stats(r, cfg->levels[i].name);
+  }
+}
+
+i64 ref_hierarchy::get_mismatches(){
+  return mismatches;
+}
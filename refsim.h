@@ -0,0 +1,131 @@
+#ifndef REFSIM_H
+#define REFSIM_H
+
+#include <unordered_map>
+#include "utils.h"
+#include "stats.h"
+#include "hier.h"
+
+// reference model of the cache hierarchy, for checking the simulator
+// against (see cache_diff). It keeps the behaviour of hierarchy_t and
+// tcache_t as of when it was written, in the plainest form: lines are
+// structs, tags are searched one way at a time, LRU and FIFO order come
+// from use and fill times, memory is a hash of words and the map a hash
+// of zero bits per page. Nothing here is meant to be fast; when the
+// simulator's behaviour changes on purpose, this changes with it.
+
+// words by address, absent words are zero
+class ref_memory {
+  std::unordered_map<i64, i64> words;
+  i32 ishift; // from an address to its word
+ public:
+  ref_memory(i32 ofs);
+  void read_block(i64 addr, i64* out, i32 n);
+  void write_block(i64 addr, const i64* in, i32 n);
+};
+
+// the map's zero bits: a set bit means the block may hold nonzero words.
+// Entries hold 32 bits, so with more than 32 blocks to a page, blocks 32
+// apart share a bit, as in mem_map.
+class ref_map {
+  std::unordered_map<i64, i32> pages;
+  i32 enabled;
+  i32 pshift;
+  i32 bshift;
+  i32 bmask;
+ public:
+  ref_map(i32 enable, i32 ps, i32 bs, i32 ofs);
+  // 0 if the block of addr is known to be zero, 1 otherwise
+  i32 lookup(i64 addr);
+  i32 get_enabled();
+  void update_block(i64 addr, i32 nonzero);
+};
+
+typedef struct ref_line_t {
+  i64 tag;
+  i32 valid;
+  i32 dirty;
+  i64 used; // time of the last use (LRU) or fill (FIFO)
+  i64* words;
+} ref_line;
+
+class ref_cache {
+  ref_line* lines; // set by set
+  i64* data;
+  i32 nsets;
+  i32 assoc;
+  i32 bsize;
+  i32 bvals;
+  i32 bshift;
+  i32 ishift;
+  i32 policy;
+  i64 rstate;
+  i64 clock;
+  ref_cache* next_level;
+  ref_cache* prev_level;
+  ref_memory* mem;
+  ref_map* map;
+  i64 accs;
+  i64 hits;
+  i64 misses;
+  i64 writebacks;
+  i64 allocs;
+  i64 bwused;
+  i64 refills;
+  i64 zrefills;
+  i64 zwritebacks;
+  i64 zsaved;
+  ref_line* set_of(i64 addr);
+  ref_line* find(i64 addr);
+  ref_line* victim(ref_line* set);
+  void use(ref_line* lp, i32 hit);
+  i64 line_addr(ref_line* lp);
+  i32 word(i64 addr);
+  i32 line_zero(const ref_line* lp);
+  // 1 if a level above holds a nonzero word among the n words from addr
+  i32 held_above(i64 addr, i32 n);
+  void evict(ref_line* lp, i32 lock, i64 addr);
+  void writeback(ref_line* lp);
+  void refill(ref_line* lp, i64 addr);
+  ref_line* fetch(i64 addr);
+ public:
+  ref_cache(i32 ns, i32 bs, i32 as, i32 pol, i32 ofs);
+  ~ref_cache();
+  i64 read(i64 addr);
+  void read_block(i64 addr, i64* out, i32 ofs, i32 n);
+  void write(i64 addr, i64 data);
+  void allocate(i64 addr);
+  void touch(i64 addr);
+  void copy(i64 addr, const i64* in, i32 ofs, i32 n, i32 dirty);
+  // the counters of tcache_t, under the same names
+  void reg_stats(stat_registry* r, const char* name);
+  void set_next(ref_cache* cp);
+  void set_mem(ref_memory* mp);
+  void set_map(ref_map* mp);
+  i64 get_accs();
+  i64 get_hits();
+  void set_accs(i64 num);
+  void set_hits(i64 num);
+};
+
+class ref_hierarchy {
+  ref_cache** levels;
+  i32 nlevels;
+  ref_map* mp;
+  ref_memory* sp;
+  i32 mixed; // some level's lines are not the map's blocks
+  i32 l1fits; // an L1 line lies within one map block
+  i32 mshift;
+  i32 mwords;
+  i64 mismatches;
+  void mark_nonzero(i64 addr);
+ public:
+  ref_hierarchy(hier_cfg* cfg, i32 ofs);
+  ~ref_hierarchy();
+  // as hierarchy_t::access
+  i64 access(const trace_rec* rec);
+  void reg_stats(stat_registry* r, hier_cfg* cfg);
+  i64 get_mismatches();
+};
+
+#endif /* REFSIM_H */
@@ -0,0 +1,109 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <thread>
+#include <assert.h>
+#include "utils.h"
+
+// lock-free ring of preallocated slots with one producer and one or more
+// readers; every reader sees every slot (broadcast), the producer fills a
+// slot in place once all readers have handed it back
+
+#define MAX_READERS 256
+
+template <class T>
+class batch_ring {
+  // reader positions, each on its own cache line
+  typedef struct reader_pos {
+    alignas(64) std::atomic<i64> tail;
+  } reader_pos;
+
+  T* slots;
+  i32 nslots;
+  i32 smask;
+  i32 nreaders;
+  reader_pos* tails;       // slots released by each reader
+  alignas(64) std::atomic<i64> head; // slots published by the producer
+  alignas(64) std::atomic<i32> done;
+  i64 minseen;             // producer's cached lower bound on the tails
+
+  static void pause(i32& spins){
+    if (++spins > 64){
+      std::this_thread::yield();
+      spins = 0;
+    }
+  }
+
+  i64 min_tail(){
+    i64 m = tails[0].tail.load(std::memory_order_acquire);
+    for (i32 r = 1;r < nreaders;r++){
+      i64 t = tails[r].tail.load(std::memory_order_acquire);
+      m = (t < m) ? t : m;
+    }
+    return m;
+  }
+
+ public:
+  batch_ring(i32 n, i32 readers = 1){
+    assert(pow2(n));
+    assert(readers > 0 && readers <= MAX_READERS);
+    slots = new T[n];
+    nslots = n;
+    smask = n - 1;
+    nreaders = readers;
+    tails = new reader_pos[readers];
+    for (i32 r = 0;r < readers;r++){
+      tails[r].tail.store(0);
+    }
+    head.store(0);
+    done.store(0);
+    minseen = 0;
+  }
+
+  ~batch_ring(){
+    delete[] slots;
+    delete[] tails;
+  }
+
+  // producer side: wait for a free slot, fill it, then commit it
+  T* produce_begin(){
+    i64 h = head.load(std::memory_order_relaxed);
+    i32 spins = 0;
+    while (h - minseen >= nslots){
+      minseen = min_tail();
+      if (h - minseen >= nslots){
+	pause(spins);
+      }
+    }
+    return &(slots[h & smask]);
+  }
+
+  void produce_commit(){
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  void finish(){
+    done.store(1, std::memory_order_release);
+  }
+
+  // reader side: returns 0 once the producer has finished and the reader
+  // has seen every slot
+  T* consume_begin(i32 r = 0){
+    i64 t = tails[r].tail.load(std::memory_order_relaxed);
+    i32 spins = 0;
+    while (t == head.load(std::memory_order_acquire)){
+      if (done.load(std::memory_order_acquire) && t == head.load(std::memory_order_acquire)){
+	return 0;
+      }
+      pause(spins);
+    }
+    return &(slots[t & smask]);
+  }
+
+  void consume_commit(i32 r = 0){
+    tails[r].tail.store(tails[r].tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+};
+
+#endif /* RING_H */
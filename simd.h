@@ -0,0 +1,68 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "utils.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+// bitmask of the entries of tags[0..n) equal to tag, n <= 64; compares
+// 4 ways per instruction with AVX2, 2 with SSE2
+inline i64 simd_match64(const i64* tags, i32 n, i64 tag){
+  i64 m = 0;
+  i32 i = 0;
+#ifdef __AVX2__
+  __m256i t4 = _mm256_set1_epi64x(tag);
+  for (;i + 4 <= n;i += 4){
+    __m256i v = _mm256_loadu_si256((const __m256i*) (tags + i));
+    i64 b = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, t4)));
+    m |= b << i;
+  }
+#endif
+#ifdef __SSE2__
+  // no 64-bit compare in SSE2: both 32-bit halves have to match
+  __m128i t2 = _mm_set1_epi64x(tag);
+  for (;i + 2 <= n;i += 2){
+    __m128i v = _mm_loadu_si128((const __m128i*) (tags + i));
+    __m128i e = _mm_cmpeq_epi32(v, t2);
+    e = _mm_and_si128(e, _mm_shuffle_epi32(e, _MM_SHUFFLE(2, 3, 0, 1)));
+    i64 b = _mm_movemask_pd(_mm_castsi128_pd(e));
+    m |= b << i;
+  }
+#endif
+  for (;i < n;i++){
+    m |= ((i64) (tags[i] == tag)) << i;
+  }
+  return m;
+}
+
+// 1 if all n words of a line are zero; ORs 4 words per instruction with
+// AVX2, 2 with SSE2
+inline i32 simd_all_zero(const i64* v, i32 n){
+  i32 i = 0;
+  i64 any = 0;
+#ifdef __AVX2__
+  __m256i a4 = _mm256_setzero_si256();
+  for (;i + 4 <= n;i += 4){
+    a4 = _mm256_or_si256(a4, _mm256_loadu_si256((const __m256i*) (v + i)));
+  }
+  if (!_mm256_testz_si256(a4, a4)){
+    return 0;
+  }
+#endif
+#ifdef __SSE2__
+  __m128i a2 = _mm_setzero_si128();
+  for (;i + 2 <= n;i += 2){
+    a2 = _mm_or_si128(a2, _mm_loadu_si128((const __m128i*) (v + i)));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(a2, _mm_setzero_si128())) != 0xFFFF){
+    return 0;
+  }
+#endif
+  for (;i < n;i++){
+    any |= v[i];
+  }
+  return any == 0;
+}
+
+#endif /* SIMD_H */
@@ -0,0 +1,312 @@
+#include "sink.h"
+#include <string.h>
+#include <assert.h>
+#include <thread>
+#include <deque>
+#include <zlib.h>
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+
+// the writer thread runs while any sink is open
+
+typedef struct sink_job_t {
+  buf_sink* sink;
+  unsigned char* buf;
+  i32 n;
+} sink_job;
+
+static std::mutex wlock;
+static std::condition_variable wcv;
+static std::deque<sink_job> jobs;
+static std::thread* writer = 0;
+static i32 users = 0;
+
+void sink_write_loop(){
+  std::unique_lock<std::mutex> g(wlock);
+  while (true){
+    while (jobs.empty() && users > 0){
+      wcv.wait(g);
+    }
+    if (jobs.empty()){
+      return;
+    }
+    sink_job j = jobs.front();
+    jobs.pop_front();
+    g.unlock();
+    j.sink->emit(j.buf, j.n);
+    j.sink->done(j.buf);
+    g.lock();
+  }
+}
+
+buf_sink::buf_sink(){
+  buf = 0;
+  n = 0;
+  werr = 0;
+  nspare = nbufs = pending = 0;
+}
+
+buf_sink::~buf_sink(){
+}
+
+// called by open once the output is ready
+void buf_sink::start(){
+  buf = new unsigned char[SINK_BUF];
+  nbufs = 1;
+  n = 0;
+
+  std::lock_guard<std::mutex> g(wlock);
+  if (users++ == 0){
+    if (writer != 0){
+      writer->join();
+      delete writer;
+    }
+    writer = new std::thread(sink_write_loop);
+  }
+}
+
+// hand the full buffer to the writer and carry on in a free one
+void buf_sink::flush(){
+  {
+    std::lock_guard<std::mutex> g(wlock);
+    jobs.push_back({this, buf, (i32) n});
+  }
+  wcv.notify_one();
+
+  std::unique_lock<std::mutex> g(lock);
+  pending++;
+  if (nspare == 0 && nbufs < SINK_NBUFS){
+    buf = new unsigned char[SINK_BUF];
+    nbufs++;
+  }else{
+    while (nspare == 0){
+      cv.wait(g);
+    }
+    buf = spare[--nspare];
+  }
+  n = 0;
+}
+
+void buf_sink::done(unsigned char* b){
+  std::lock_guard<std::mutex> g(lock);
+  spare[nspare++] = b;
+  pending--;
+  cv.notify_one();
+}
+
+void buf_sink::close(){
+  if (buf == 0){
+    return;
+  }
+  if (n > 0){
+    flush();
+  }
+  {
+    std::unique_lock<std::mutex> g(lock);
+    while (pending > 0){
+      cv.wait(g);
+    }
+  }
+  finish();
+  delete[] buf;
+  buf = 0;
+  for (i32 i = 0;i < nspare;i++){
+    delete[] spare[i];
+  }
+  nspare = nbufs = 0;
+
+  std::thread* t = 0;
+  {
+    std::lock_guard<std::mutex> g(wlock);
+    if (--users == 0){
+      t = writer;
+      writer = 0;
+    }
+  }
+  if (t != 0){
+    wcv.notify_one();
+    t->join();
+    delete t;
+  }
+}
+
+i32 buf_sink::failed(){
+  return werr;
+}
+
+int vs_type(const char* name){
+  if (strcmp(name, "none") == 0){
+    return VS_NONE;
+  }
+  if (strcmp(name, "gz") == 0){
+    return VS_GZIP;
+  }
+#ifdef ZSTD
+  if (strcmp(name, "zst") == 0){
+    return VS_ZSTD;
+  }
+#endif
+  return -1;
+}
+
+static const char* vs_exts[] = { ".vtr", ".vtr.gz", ".vtr.zst" };
+
+value_sink::value_sink(){
+  out = 0;
+  gz = 0;
+  zc = 0;
+  zbuf = 0;
+  zcap = 0;
+}
+
+value_sink::~value_sink(){
+  close();
+}
+
+i32 value_sink::open(const char* app, i32 c, i64 mrecs, i64 mbytes){
+  snprintf(prefix, sizeof(prefix), "%s", app);
+  comp = c;
+  max_recs = mrecs;
+  max_bytes = mbytes;
+  fnum = 0;
+#ifdef ZSTD
+  if (comp == VS_ZSTD){
+    zcap = ZSTD_compressBound(SINK_BUF);
+    zbuf = new char[zcap];
+    zc = ZSTD_createCCtx();
+  }
+#endif
+  next_file();
+  if (out == 0 && gz == 0){
+    return 0;
+  }
+  start();
+  return 1;
+}
+
+// open <app>_l2trace<fnum>; compressed files are compressed whole, header
+// included, so they read back through a zpipe like compressed traces
+void value_sink::next_file(){
+  vtrace_hdr hdr;
+
+  snprintf(fname, sizeof(fname), "%s_l2trace%u%s", prefix, fnum, vs_exts[comp]);
+  if (fnum > 0){
+    fprintf(stderr, "Filled trace with %lu values, closing trace and opening new trace: %s\n", recs, fname);
+  }
+  fnum++;
+  recs = bytes = 0;
+
+  if (comp == VS_GZIP){
+    gz = gzopen(fname, "wb1");
+  }else{
+    out = fopen(fname, "wb");
+  }
+  if (out == 0 && gz == 0){
+    perror(fname);
+    werr = 1;
+    return;
+  }
+  memset(&hdr, 0, sizeof(vtrace_hdr));
+  hdr.magic = VTRACE_MAGIC;
+  hdr.version = VTRACE_VERSION;
+  hdr.recsize = sizeof(i64);
+  hdr.flags = comp;
+  write_out((const unsigned char*) &hdr, sizeof(vtrace_hdr));
+}
+
+// a full disk may only show when the buffered rest is written out
+void value_sink::end_file(){
+  i32 ok = 1;
+  if (gz != 0){
+    ok = (gzclose((gzFile) gz) == Z_OK);
+    gz = 0;
+  }
+  if (out != 0){
+    ok = (fclose(out) == 0);
+    out = 0;
+  }
+  if (!ok && !werr){
+    perror(fname);
+  }
+  werr |= !ok;
+}
+
+// the first failed write is reported, the values after it are lost
+void value_sink::write_out(const unsigned char* b, i64 len){
+  i32 ok;
+  if (comp == VS_GZIP){
+    ok = (gzwrite((gzFile) gz, b, len) == (int) len);
+    bytes = gzoffset((gzFile) gz);
+  }
+#ifdef ZSTD
+  else if (comp == VS_ZSTD){
+    // every buffer is a frame of its own, frames simply follow each other
+    size_t z = ZSTD_compressCCtx((ZSTD_CCtx*) zc, zbuf, zcap, b, len, 1);
+    ok = !ZSTD_isError(z) && fwrite(zbuf, 1, z, out) == z;
+    bytes += ZSTD_isError(z) ? 0 : z;
+  }
+#endif
+  else{
+    ok = (fwrite(b, 1, len, out) == (size_t) len);
+    bytes += len;
+  }
+  if (!ok && !werr){
+    perror(fname);
+  }
+  werr |= !ok;
+}
+
+// split a buffer where files are full
+void value_sink::emit(const unsigned char* b, i32 len){
+  i64 nrecs = len / sizeof(i64);
+  while (nrecs > 0){
+    if ((out == 0 && gz == 0) || recs == max_recs || (max_bytes != 0 && bytes >= max_bytes)){
+      end_file();
+      next_file();
+      if (out == 0 && gz == 0){
+	return;
+      }
+    }
+    i64 cnt = max_recs - recs;
+    cnt = (cnt < nrecs) ? cnt : nrecs;
+    write_out(b, cnt * sizeof(i64));
+    recs += cnt;
+    b += cnt * sizeof(i64);
+    nrecs -= cnt;
+  }
+}
+
+void value_sink::finish(){
+  end_file();
+#ifdef ZSTD
+  if (zc != 0){
+    ZSTD_freeCCtx((ZSTD_CCtx*) zc);
+    zc = 0;
+  }
+#endif
+  delete[] zbuf;
+  zbuf = 0;
+}
+
+i32 vtrace_decode(FILE* in, const char* name, FILE* out, i64* count){
+  vtrace_hdr hdr;
+  i64* v;
+  size_t got;
+
+  *count = 0;
+  if (fread(&hdr, sizeof(vtrace_hdr), 1, in) != 1 || hdr.magic != VTRACE_MAGIC ||
+      hdr.version != VTRACE_VERSION || hdr.recsize != sizeof(i64)){
+    fprintf(stderr, "%s: not a value trace\n", name);
+    return 0;
+  }
+  v = new i64[SINK_BUF / sizeof(i64)];
+  while ((got = fread(v, sizeof(i64), SINK_BUF / sizeof(i64), in)) > 0){
+    for (size_t i = 0;i < got;i++){
+      fprintf(out, "%lx\n", v[i]);
+    }
+    *count += got;
+  }
+  delete[] v;
+  return 1;
+}
@@ -0,0 +1,103 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <mutex>
+#include <condition_variable>
+#include "utils.h"
+
+// output written off the simulating thread: records are appended to a
+// buffer, full buffers are handed to one writer thread shared by all open
+// sinks and come back to be refilled, so a sink never has more than
+// SINK_NBUFS buffers in use
+
+#define SINK_BUF (1 << 20)
+#define SINK_NBUFS 4
+
+class buf_sink {
+  friend void sink_write_loop();
+  std::mutex lock;
+  std::condition_variable cv;
+  unsigned char* spare[SINK_NBUFS];
+  i32 nspare;
+  i32 nbufs;
+  i32 pending;
+ protected:
+  unsigned char* buf;
+  i32 n;
+  i32 werr; // some output could not be written, set on the writer thread
+  void start();
+  void flush();
+  // called on the writer thread with each full buffer, in order
+  virtual void emit(const unsigned char* b, i32 len) = 0;
+  // called by close once everything has been emitted
+  virtual void finish() = 0;
+ public:
+  buf_sink();
+  virtual ~buf_sink();
+  // buffer b has been written
+  void done(unsigned char* b);
+  // emit what is left and wait for the writer
+  void close();
+  // 1 if some output could not be written, once closed
+  i32 failed();
+};
+
+// values read from memory, 64 bits each, in <app>_l2trace<N>.vtr files
+// that are optionally compressed; a new file is started once one has
+// max_recs records (at least 1) or max_bytes bytes (after compression,
+// 0 for no limit) in it
+
+#define VTRACE_MAGIC 0x43525456 // "VTRC"
+#define VTRACE_VERSION 1
+
+#define VS_NONE 0
+#define VS_GZIP 1
+#define VS_ZSTD 2
+
+typedef struct vtrace_hdr_t {
+  i32 magic;
+  i32 version;
+  i32 recsize;
+  i32 flags;
+} vtrace_hdr;
+
+class value_sink : public buf_sink {
+  char prefix[256];
+  i32 comp;
+  i64 max_recs;
+  i64 max_bytes;
+  i32 fnum;
+  char fname[300];
+  i64 recs;
+  i64 bytes;
+  FILE* out;
+  void* gz;
+  void* zc;
+  char* zbuf;
+  i64 zcap;
+  void next_file();
+  void end_file();
+  void write_out(const unsigned char* b, i64 len);
+ protected:
+  void emit(const unsigned char* b, i32 len);
+  void finish();
+ public:
+  value_sink();
+  ~value_sink();
+  i32 open(const char* app, i32 comp, i64 max_recs, i64 max_bytes);
+  inline void put(i64 v){
+    *((i64*) (buf + n)) = v;
+    n += sizeof(i64);
+    if (n == SINK_BUF){
+      flush();
+    }
+  }
+};
+
+// compression type by name: none, gz or zst; -1 if unknown
+int vs_type(const char* name);
+// write a value trace out as text, one hex value per line, and the number
+// of values to *count; returns 0 if in is not a value trace
+i32 vtrace_decode(FILE* in, const char* name, FILE* out, i64* count);
+
+#endif /* SINK_H */
@@ -0,0 +1,190 @@
+#include "stackdist.h"
+#include "tcache.h"
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define SD_INIT_CAP (1 << 20)
+
+// 64-bit finalizer, spreads block and set numbers over the sample space
+static i64 sd_hash(i64 x){
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+stack_dist::stack_dist(i32 bs, i32 ofs, double r){
+  bsize = bs;
+  bshift = tcache::block_shift(bs, ofs);
+  rate = r;
+  thresh = (i64)(r * (1 << SD_HASH_BITS));
+
+  cap = SD_INIT_CAP;
+  bit = new i64[cap + 1]();
+  now = 0;
+
+  for (i32 l = 0;l < SD_SET_LEVELS;l++){
+    stacks[l] = (i64 *)arena_alloc(((i64) MAX_ASSOC << l) * sizeof(i64));
+    // small set counts see every reference, there are too few sets to sample
+    sampled[l] = (rate < 1.0) && ((1 << l) * rate >= SD_MIN_SETS);
+  }
+  clearstats();
+}
+
+void stack_dist::clearstats(){
+  frefs = 0;
+  memset(fhist, 0, sizeof(fhist));
+  memset(srefs, 0, sizeof(srefs));
+  memset(shist, 0, sizeof(shist));
+}
+
+i32 stack_dist::keep(i64 key){
+  return (sd_hash(key) & ((1 << SD_HASH_BITS) - 1)) < thresh;
+}
+
+void stack_dist::bit_add(i64 pos, i64 v){
+  for (i64 i = pos + 1;i <= cap;i += i & -i){
+    bit[i] += v;
+  }
+}
+
+// ones at times [0, pos]
+i64 stack_dist::bit_sum(i64 pos){
+  i64 s = 0;
+  for (i64 i = pos + 1;i > 0;i -= i & -i){
+    s += bit[i];
+  }
+  return s;
+}
+
+// renumber the live last references 0..n-1 in time order, growing the
+// tree when it would be more than half full afterwards
+void stack_dist::compact(){
+  std::vector<std::pair<i64, i64> > live;
+  live.reserve(last.size());
+  for (auto it = last.begin();it != last.end();++it){
+    live.push_back(std::make_pair(it->second, it->first));
+  }
+  std::sort(live.begin(), live.end());
+
+  if ((i64) live.size() * 2 > cap){
+    cap *= 2;
+  }
+  delete[] bit;
+  bit = new i64[cap + 1]();
+  for (now = 0;now < (i64) live.size();now++){
+    last[live[now].second] = now;
+    bit_add(now, 1);
+  }
+}
+
+void stack_dist::full_access(i64 block){
+  auto it = last.find(block);
+
+  frefs++;
+  if (it == last.end()){
+    fhist[SD_BUCKETS]++;
+  }else{
+    // distinct blocks referenced since, scaled up when sampling
+    i64 d = last.size() - bit_sum(it->second);
+    if (rate < 1.0){
+      d = (i64)(d / rate);
+    }
+    fhist[(d == 0) ? 0 : 64 - __builtin_clzl(d)]++;
+    bit_add(it->second, -1);
+  }
+
+  if (now == cap){
+    compact();
+  }
+  bit_add(now, 1);
+  last[block] = now++;
+}
+
+void stack_dist::set_access(i32 lvl, i64 block){
+  i64* st = stacks[lvl] + (block & ((1 << lvl) - 1)) * MAX_ASSOC;
+  i64 key = block + 1;
+  i32 d;
+
+  for (d = 0;d < MAX_ASSOC && st[d] != key && st[d] != 0;d++);
+  if (d < MAX_ASSOC && st[d] == key){
+    shist[lvl][d]++;
+  }
+  // move to the front, the LRU block falls off a full stack
+  memmove(st + 1, st, ((d < MAX_ASSOC) ? d : MAX_ASSOC - 1) * sizeof(i64));
+  st[0] = key;
+  srefs[lvl]++;
+}
+
+void stack_dist::access(i64 addr){
+  i64 block = addr >> bshift;
+
+  if (rate >= 1.0 || keep(block)){
+    full_access(block);
+  }
+  for (i32 l = 0;l < SD_SET_LEVELS;l++){
+    if (sampled[l] == 0 || keep(block & ((1 << l) - 1))){
+      set_access(l, block);
+    }
+  }
+}
+
+static void print_size(i64 bytes){
+  char buf[32];
+  if (bytes >= (1UL << 30)){
+    sprintf(buf, "%lu GB", bytes >> 30);
+  }else if (bytes >= (1UL << 20)){
+    sprintf(buf, "%lu MB", bytes >> 20);
+  }else if (bytes >= 1024){
+    sprintf(buf, "%lu KB", bytes >> 10);
+  }else{
+    sprintf(buf, "%lu B", bytes);
+  }
+  printf("%8s", buf);
+}
+
+void stack_dist::stats(){
+  i64 blocks = last.size();
+  i64 hits = 0;
+  i32 rows = 0;
+
+  if (rate < 1.0){
+    blocks = (i64)(blocks / rate);
+  }
+  while (rows < SD_BUCKETS - 1 && (1UL << rows) < blocks){
+    rows++;
+  }
+
+  printf("LRU miss ratio curve, %u B blocks", bsize);
+  if (rate < 1.0){
+    printf(", sampled at rate %g", rate);
+  }
+  printf("\n%lu references, %lu distinct blocks\n", frefs, blocks);
+  printf("%8s %9s", "size", "full");
+  for (i32 a = 1;a <= MAX_ASSOC;a <<= 1){
+    printf(" %6u-way", a);
+  }
+  printf("\n");
+
+  for (i32 k = 0;k <= rows;k++){
+    hits += fhist[k];
+    print_size((1UL << k) * bsize);
+    printf(" %9.6f", frefs ? (double)(frefs - hits) / frefs : 0.0);
+    for (i32 a = 0;(1 << a) <= MAX_ASSOC;a++){
+      int l = (int) k - (int) a;
+      if (l < 0 || l >= SD_SET_LEVELS || srefs[l] == 0){
+	printf(" %10s", "-");
+	continue;
+      }
+      i64 shits = 0;
+      for (i32 d = 0;d < (1U << a);d++){
+	shits += shist[l][d];
+      }
+      printf(" %10.6f", (double)(srefs[l] - shits) / srefs[l]);
+    }
+    printf("\n");
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef STACKDIST_H
+#define STACKDIST_H
+
+#include <unordered_map>
+#include "utils.h"
+
+// LRU miss ratio curves for every power of two size and associativity in
+// one pass, from Mattson stack distances at a fixed block size. Fully
+// associative distances come from a Fenwick tree over reference times,
+// set associative ones from bounded per-set stacks for each set count.
+
+#define SD_SET_LEVELS 17   // per-set stacks for 1 .. 64K sets
+#define SD_BUCKETS 64      // log2 distance buckets
+#define SD_HASH_BITS 24
+#define SD_MIN_SETS 64     // sampled sets needed before a set count is sampled
+
+class stack_dist {
+  i32 bsize;
+  i32 bshift;
+  double rate;
+  i64 thresh;
+
+  // fully associative: last reference time of each block, and a one in
+  // the tree at every block's last reference
+  std::unordered_map<i64, i64> last;
+  i64* bit;
+  i64 cap;
+  i64 now;
+  i64 frefs;
+  i64 fhist[SD_BUCKETS+1]; // distances in [2^(b-1), 2^b) at b, cold misses last
+
+  // set associative: MRU-first stacks of MAX_ASSOC blocks (+1, 0 is empty)
+  i64* stacks[SD_SET_LEVELS];
+  i32 sampled[SD_SET_LEVELS];
+  i64 srefs[SD_SET_LEVELS];
+  i64 shist[SD_SET_LEVELS][MAX_ASSOC];
+
+  i32 keep(i64 key);
+  void bit_add(i64 pos, i64 v);
+  i64 bit_sum(i64 pos);
+  void compact();
+  void full_access(i64 block);
+  void set_access(i32 lvl, i64 block);
+ public:
+  stack_dist(i32 bs, i32 ofs, double rate);
+  void access(i64 addr);
+  void clearstats();
+  void stats();
+};
+
+#endif /* STACKDIST_H */
@@ -0,0 +1,102 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+stat_registry::stat_registry(){
+  out = 0;
+  json = 0;
+  rowlen = 0;
+  lsample = 0;
+}
+
+stat_registry::~stat_registry(){
+  close();
+  for (size_t i = 0;i < names.size();i++){
+    free(names[i]);
+  }
+}
+
+void stat_registry::add(const char* scope, const char* name, const i64* v){
+  char* s = (char *)malloc(strlen(scope) + strlen(name) + 2);
+  sprintf(s, "%s.%s", scope, name);
+  names.push_back(s);
+  ctrs.push_back({v, *v});
+}
+
+i32 stat_registry::open(const char* file, i32 js){
+  out = fopen(file, "w");
+  if (out == NULL){
+    return 0;
+  }
+  json = js;
+  rowlen = (ctrs.size() + 1) * sizeof(i64);
+  if (json == 0){
+    fputs("accesses", out);
+    for (size_t i = 0;i < names.size();i++){
+      fprintf(out, ",%s", names[i]);
+    }
+    fputc('\n', out);
+  }
+  start();
+  return 1;
+}
+
+void stat_registry::sample(i64 accs){
+  if (buf == 0 || accs == lsample){
+    return;
+  }
+  if (n + rowlen > SINK_BUF){
+    flush();
+  }
+  i64* row = (i64*) (buf + n);
+  row[0] = accs;
+  for (size_t i = 0;i < ctrs.size();i++){
+    i64 v = *(ctrs[i].v);
+    row[i+1] = v - ctrs[i].last;
+    ctrs[i].last = v;
+  }
+  n += rowlen;
+  lsample = accs;
+}
+
+void stat_registry::rebase(){
+  for (size_t i = 0;i < ctrs.size();i++){
+    ctrs[i].last = *(ctrs[i].v);
+  }
+}
+
+void stat_registry::emit(const unsigned char* b, i32 len){
+  for (i32 r = 0;r < len / rowlen;r++){
+    const i64* row = (const i64*) (b + r * rowlen);
+    if (json){
+      fprintf(out, "{\"accesses\": %lu", row[0]);
+      for (size_t i = 0;i < names.size();i++){
+	fprintf(out, ", \"%s\": %lu", names[i], row[i+1]);
+      }
+      fputs("}\n", out);
+    }else{
+      fprintf(out, "%lu", row[0]);
+      for (size_t i = 0;i < names.size();i++){
+	fprintf(out, ",%lu", row[i+1]);
+      }
+      fputc('\n', out);
+    }
+  }
+}
+
+void stat_registry::finish(){
+  fclose(out);
+  out = 0;
+}
+
+i32 stat_registry::size(){
+  return ctrs.size();
+}
+
+const i64* stat_registry::counter(i32 i){
+  return ctrs[i].v;
+}
+
+const char* stat_registry::name(i32 i){
+  return names[i];
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <vector>
+#include "sink.h"
+
+// interval statistics: cache levels and the memory map register their
+// 64-bit counters by name, and every sample appends how much each has
+// grown since the last one, as a row of raw counts in the sink's buffers.
+// The writer thread turns rows into CSV (a header line, then one line per
+// sample) or JSON lines, so the simulating thread only copies counters.
+
+typedef struct stat_counter_t {
+  const i64* v;
+  i64 last;
+} stat_counter;
+
+class stat_registry : public buf_sink {
+  std::vector<stat_counter> ctrs;
+  std::vector<char*> names;
+  FILE* out;
+  i32 json;
+  i32 rowlen;
+  i64 lsample; // accesses at the last sample
+ protected:
+  void emit(const unsigned char* b, i32 len);
+  void finish();
+ public:
+  stat_registry();
+  ~stat_registry();
+  // counter v reported as scope.name; all counters are added before open
+  void add(const char* scope, const char* name, const i64* v);
+  i32 open(const char* file, i32 json);
+  // one row of deltas, ending after accs accesses
+  void sample(i64 accs);
+  // the counters were cleared, later deltas start from their new values
+  void rebase();
+  // the counters added so far, in order, and their scope.name
+  i32 size();
+  const i64* counter(i32 i);
+  const char* name(i32 i);
+};
+
+#endif /* STATS_H */
@@ -1,46 +1,330 @@
 #include "store.h"
+#include <string.h>
+
+#define PT_SIZE (1 << PT_BITS)
+#define PT_MASK (PT_SIZE - 1)
+
+// every all-zero page of every memory maps to this one
+static tpage zero_page;
+
+#define PG_PTR(p) ((tpage*) ((i64) (p) & ~PG_RO))
+#define PG_IS_RO(p) (((i64) (p) & PG_RO) != 0)
+
+page_pool::page_pool(){
+  next = end = free = 0;
+  slabs = live = peak = 0;
+}
+
+page_pool::~page_pool(){
+  for (i64 i = 0;i < (i64) slabv.size();i++){
+    arena_free(slabv[i], POOL_SLAB * sizeof(tpage));
+  }
+}
+
+tpage* page_pool::get(){
+  tpage* pg;
+  if (free != 0){
+    pg = free;
+    free = *((tpage**) pg);
+  }else{
+    if (next == end){
+      next = (tpage*) arena_alloc(POOL_SLAB * sizeof(tpage));
+      end = next + POOL_SLAB;
+      slabv.push_back(next);
+      slabs++;
+    }
+    pg = next++;
+  }
+  live++;
+  if (live > peak){
+    peak = live;
+  }
+  return pg;
+}
+
+void page_pool::put(tpage* pg){
+  *((tpage**) pg) = free;
+  free = pg;
+  live--;
+}
 
 // create the pointers
 tmemory::tmemory(i32 os){
   //printf("Entering create_memory\n");
-  i32 pgs = 1<<(20+os);
-  pages = new tpage*[pgs];
-  pmask = pgs - 1;
   pshift = 12-os;
   fmask = (1<<pshift) - 1;
   ishift = 3 - os; // 3 bits for 64b values
-  //printf("pages: %d, page mask: %08X, frame mask: %08X\n", pages, pmask, fmask);
-
+  // whatever the leaf and directories leave of the page number
+  rbits = 64 - pshift - 3*PT_BITS;
+  root = new void*[1 << rbits]();
+  lkey = -1;
+  lleaf = 0;
+  dedup = 0;
+  next_dedup = DEDUP_MIN;
+  zeros = cows = merged = 0;
   //printf("Leaving create_memory\n");
 }
 
-i64 tmemory::read(i32 addr){
+// the page table; the pages go back with the pool
+tmemory::~tmemory(){
+  for (i64 r = 0;r < (1UL << rbits);r++){
+    void** d1 = (void**) root[r];
+    for (i32 i = 0;d1 != 0 && i < PT_SIZE;i++){
+      void** d2 = (void**) d1[i];
+      for (i32 j = 0;d2 != 0 && j < PT_SIZE;j++){
+	delete[] (tpage**) d2[j];
+      }
+      delete[] d2;
+    }
+    delete[] d1;
+  }
+  delete[] root;
+}
+
+void tmemory::set_dedup(i32 on){
+  dedup = on;
+}
+
+// leaf of page pointers covering page pnum, or 0 if it is not there and
+// alloc is not set
+tpage** tmemory::leaf(i64 pnum, i32 alloc){
+  i64 key = pnum >> PT_BITS;
+  if (key == lkey){
+    return lleaf;
+  }
+  void** d1 = (void**) root[key >> (2*PT_BITS)];
+  if (d1 == 0){
+    if (!alloc) return 0;
+    d1 = new void*[PT_SIZE]();
+    root[key >> (2*PT_BITS)] = d1;
+  }
+  void** d2 = (void**) d1[(key >> PT_BITS) & PT_MASK];
+  if (d2 == 0){
+    if (!alloc) return 0;
+    d2 = new void*[PT_SIZE]();
+    d1[(key >> PT_BITS) & PT_MASK] = d2;
+  }
+  tpage** lp = (tpage**) d2[key & PT_MASK];
+  if (lp == 0){
+    if (!alloc) return 0;
+    lp = new tpage*[PT_SIZE]();
+    d2[key & PT_MASK] = lp;
+  }
+  lkey = key;
+  lleaf = lp;
+  return lp;
+}
+
+// page holding addr for reading, 0 if it was never written
+tpage* tmemory::rpage(i64 addr){
+  i64 pnum = addr >> pshift;
+  tpage** lp = leaf(pnum, 0);
+  return (lp == 0) ? 0 : PG_PTR(lp[pnum & PT_MASK]);
+}
+
+// leaf entry of the page holding addr
+tpage** tmemory::slot(i64 addr){
+  i64 pnum = addr >> pshift;
+  return &(leaf(pnum, 1)[pnum & PT_MASK]);
+}
+
+// for a write of zeros: an empty entry maps the zero page, and the write
+// can be dropped if the entry maps it
+i32 tmemory::zero_fill(tpage** sp){
+  if (*sp == 0){
+    *sp = (tpage*) ((i64) &zero_page | PG_RO);
+    zeros++;
+  }
+  return PG_PTR(*sp) == &zero_page;
+}
+
+// page of entry sp for writing: one of its own, made from the zero page
+// or a copy of the shared page it mapped until now
+tpage* tmemory::wpage(tpage** sp){
+  tpage* pg = *sp;
+  tpage* np;
+
+  if (pg != 0 && !PG_IS_RO(pg)){
+    return pg;
+  }
+  if (dedup && pool.live >= next_dedup){
+    merge();
+    pg = *sp;
+    if (pg != 0 && !PG_IS_RO(pg)){
+      return pg;
+    }
+  }
+
+  pg = PG_PTR(pg);
+  if (pg == 0 || pg == &zero_page){
+    np = pool.get();
+    memset(np, 0, sizeof(tpage));
+    zeros -= (pg != 0);
+  }else{
+    auto it = refs.find(pg);
+    if (it == refs.end()){
+      // the other mappings are gone, this one is the owner now
+      *sp = pg;
+      return pg;
+    }
+    if (--(it->second) == 1){
+      refs.erase(it);
+    }
+    np = pool.get();
+    memcpy(np, pg, sizeof(tpage));
+    cows++;
+  }
+  *sp = np;
+  return np;
+}
+
+// map pages that turned out all zero to the zero page, and pages with the
+// same contents to one shared copy, returning the rest to the pool
+void tmemory::merge(){
+  std::unordered_map<i64, tpage**> seen;
+
+  for (i64 r = 0;r < (1UL << rbits);r++){
+    void** d1 = (void**) root[r];
+    for (i32 i = 0;d1 != 0 && i < PT_SIZE;i++){
+      void** d2 = (void**) d1[i];
+      for (i32 j = 0;d2 != 0 && j < PT_SIZE;j++){
+	tpage** lp = (tpage**) d2[j];
+	for (i32 k = 0;lp != 0 && k < PT_SIZE;k++){
+	  tpage* pg = PG_PTR(lp[k]);
+	  if (pg == 0 || pg == &zero_page){
+	    continue;
+	  }
+
+	  i64 h = 0, any = 0;
+	  for (i32 w = 0;w < 512;w++){
+	    h = (h ^ pg->data[w]) * 0x9E3779B97F4A7C15UL;
+	    any |= pg->data[w];
+	  }
+	  if (any == 0 && !PG_IS_RO(lp[k])){
+	    pool.put(pg);
+	    lp[k] = (tpage*) ((i64) &zero_page | PG_RO);
+	    zeros++;
+	    continue;
+	  }
+
+	  auto it = seen.find(h);
+	  if (it == seen.end()){
+	    seen[h] = &(lp[k]);
+	    continue;
+	  }
+	  tpage** cp = it->second;
+	  tpage* canon = PG_PTR(*cp);
+	  // only private pages are folded, into the first page seen
+	  if (canon == pg || PG_IS_RO(lp[k]) || memcmp(canon, pg, sizeof(tpage)) != 0){
+	    continue;
+	  }
+	  if (PG_IS_RO(*cp)){
+	    // a shared page down to one mapping has no entry left but is
+	    // still mapped read only, by *cp
+	    auto rit = refs.find(canon);
+	    refs[canon] = ((rit == refs.end()) ? 1 : rit->second) + 1;
+	  }else{
+	    *cp = (tpage*) ((i64) canon | PG_RO);
+	    refs[canon] = 2;
+	  }
+	  lp[k] = (tpage*) ((i64) canon | PG_RO);
+	  pool.put(pg);
+	  merged++;
+	}
+      }
+    }
+  }
+  next_dedup = (pool.live < DEDUP_MIN / 2) ? DEDUP_MIN : (pool.live << 1);
+}
+
+i64 tmemory::read(i64 addr){
   //printf("Entering mem_read\n");
-  i32 fnum = (addr >> pshift) & pmask;
+  tpage* pg = rpage(addr);
   i32 findex = (addr & fmask) >> ishift;
 
-  if (pages[fnum] == 0){
-    //printf("Memory read0 addr (%X), data(%llX)\n", addr, 0UL);
-    //fflush(stdout);
+  if (pg == 0){
     return 0UL;
   }else{
-    //printf("Memory read1 addr (%X), data(%llX)\n", addr, (pages[fnum]->data[findex]));
-    //fflush(stdout);
-    return pages[fnum]->data[findex];
+    return pg->data[findex];
   }
 }
 
-void tmemory::write(i32 addr, i64 data){ 
+void tmemory::write(i64 addr, i64 data){ 
   //printf("Entering mem_write\n");
-  i32 fnum = (addr >> pshift) & pmask;
   i32 findex = (addr & fmask) >> ishift;
 
-  //printf("Memory write addr (%X), data(%llX)\n", addr, data);
-  //fflush(stdout);
+  tpage** sp = slot(addr);
 
-  if (pages[fnum] == 0){
-    pages[fnum] = new tpage();
+  if (data == 0 && zero_fill(sp)){
+    return;
   }
-  pages[fnum]->data[findex] = data;
+  wpage(sp)->data[findex] = data;
   //printf("Leaving mem_write\n");
 }
+
+void tmemory::read_block(i64 addr, i64* out, i32 n){
+  while (n > 0){
+    tpage* pg = rpage(addr);
+    i32 findex = (addr & fmask) >> ishift;
+    i32 cnt = 512 - findex;
+    cnt = (cnt < n) ? cnt : n;
+
+    if (pg == 0){
+      memset(out, 0, cnt * sizeof(i64));
+    }else{
+      memcpy(out, &(pg->data[findex]), cnt * sizeof(i64));
+    }
+    addr += cnt << ishift;
+    out += cnt;
+    n -= cnt;
+  }
+}
+
+void tmemory::write_block(i64 addr, const i64* in, i32 n){
+  while (n > 0){
+    i32 findex = (addr & fmask) >> ishift;
+    i32 cnt = 512 - findex;
+    cnt = (cnt < n) ? cnt : n;
+
+    tpage** sp = slot(addr);
+    i64 any = 0;
+    for (i32 i = 0;i < cnt;i++){
+      any |= in[i];
+    }
+    if (any != 0 || zero_fill(sp) == 0){
+      memcpy(&(wpage(sp)->data[findex]), in, cnt * sizeof(i64));
+    }
+    addr += cnt << ishift;
+    in += cnt;
+    n -= cnt;
+  }
+}
+
+// bit masks of 64 words are stored as one word each, in the page of the
+// address 64 times lower, so they use the same sparse page table
+i64 tmemory::read_bits(i64 addr, i32 n){
+  i64 group = addr >> (ishift + 6);
+  i32 off = (addr >> ishift) & 63;
+  i64 m = (n == 64) ? ~0UL : ((1UL << n) - 1);
+  return (read(group << ishift) >> off) & m;
+}
+
+void tmemory::write_bits(i64 addr, i64 bits, i32 n){
+  i64 group = addr >> (ishift + 6);
+  i32 off = (addr >> ishift) & 63;
+  i64 m = (n == 64) ? ~0UL : ((1UL << n) - 1);
+  i64 old = read(group << ishift);
+  write(group << ishift, (old & ~(m << off)) | ((bits & m) << off));
+}
+
+void tmemory::stats(){
+  i64 maps = 0;
+  if (dedup){
+    merge();
+  }
+  for (auto it = refs.begin();it != refs.end();++it){
+    maps += it->second;
+  }
+  printf("Memory: %lu pages in use, peak %lu, %lu KB in %lu slabs\n", pool.live, pool.peak, (pool.slabs * POOL_SLAB * sizeof(tpage)) >> 10, pool.slabs);
+  printf("%lu zero pages, %lu shared pages mapped %lu times, %lu merged, %lu copied on write\n", zeros, (i64) refs.size(), maps, merged, cows);
+}
@@ -1,23 +1,88 @@
 #ifndef STORE_H
 #define STORE_H
 
+#include <unordered_map>
+#include <vector>
 #include "utils.h"
 
 typedef struct mem_page {
   i64 data[512];
 } tpage;
 
+// page table levels: a root indexed by the top bits of the page number,
+// two levels of directories and leaves of page pointers, each of 1<<PT_BITS
+// entries; nodes are only allocated for the parts of the 64-bit address
+// space a trace touches
+#define PT_BITS 13
+
+// pages are carved from slabs of POOL_SLAB; pages given back by merging
+// go on a free list and are handed out again first
+#define POOL_SLAB 256
+
+class page_pool {
+  tpage* next;
+  tpage* end;
+  tpage* free;
+  std::vector<tpage*> slabv;
+ public:
+  i64 slabs;
+  i64 live;
+  i64 peak;
+  page_pool();
+  ~page_pool();
+  // contents are undefined
+  tpage* get();
+  void put(tpage* pg);
+};
+
+// leaf entries with the low bit set point at pages that must not be
+// written in place: the canonical zero page or a page several entries
+// share; the first write copies them into a private page
+#define PG_RO 1UL
+
+// merge passes start once this many pages are in use, and then each time
+// the count has doubled since the last one
+#define DEDUP_MIN 1024
+
 class tmemory {
-  tpage** pages;
-  i32 pmask;
+  void** root;
+  i32 rbits;
   i32 fmask;
   i32 os;
   i32 pshift;
   i32 ishift;
+  // last leaf looked up, accesses mostly stay within one
+  i64 lkey;
+  tpage** lleaf;
+  page_pool pool;
+  // mappings of each shared page, pages absent here have one
+  std::unordered_map<tpage*, i32> refs;
+  i32 dedup;
+  i64 next_dedup;
+  i64 zeros;
+  i64 cows;
+  i64 merged;
+  tpage** leaf(i64 pnum, i32 alloc);
+  tpage* rpage(i64 addr);
+  tpage** slot(i64 addr);
+  i32 zero_fill(tpage** sp);
+  tpage* wpage(tpage** sp);
+  void merge();
  public:
   tmemory(i32 os);
-  i64 read(i32 addr);
-  void write(i32 addr, i64 data);
+  ~tmemory();
+  // merge identical pages from time to time
+  void set_dedup(i32 on);
+  i64 read(i64 addr);
+  void write(i64 addr, i64 data);
+  // n consecutive words starting at addr
+  void read_block(i64 addr, i64* out, i32 n);
+  void write_block(i64 addr, const i64* in, i32 n);
+  // memory behind tag-only caches keeps a bit per word, set when the word
+  // is nonzero, instead of values; n <= 64 words from a 64-word boundary
+  i64 read_bits(i64 addr, i32 n);
+  void write_bits(i64 addr, i64 bits, i32 n);
+  void stats();
 };
 
 #endif /* STORE_H */
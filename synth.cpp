@@ -0,0 +1,309 @@
+#include "synth.h"
+#include <string.h>
+#include <math.h>
+
+// xorshift64*, seeded through splitmix64 so nearby seeds give unrelated
+// streams
+
+static inline i64 sy_next(i64* s){
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545F4914F6CDD1DUL;
+}
+
+static i64 sy_mix(i64 z){
+  z += 0x9E3779B97F4A7C15UL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+  return z ^ (z >> 31);
+}
+
+// uniform in [0, n)
+static inline i64 sy_below(i64* s, i64 n){
+  return (i64) (((unsigned __int128) sy_next(s) * n) >> 64);
+}
+
+// uniform in [0, 1)
+static inline double sy_unit(i64* s){
+  return (sy_next(s) >> 11) * (1.0 / (1UL << 53));
+}
+
+// value of the word at addr: nonzero, or zero for zpct percent of words
+static inline i64 sy_value(i64 addr, i32 zpct){
+  i64 v = sy_mix(addr);
+  if (zpct != 0 && (v >> 32) % 100 < zpct){
+    return 0;
+  }
+  return v | 1;
+}
+
+static i64 sy_gcd(i64 a, i64 b){
+  while (b != 0){
+    i64 t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// 1/1^theta + ... + 1/n^theta, summed exactly over the first terms and
+// approximated by the integral beyond them
+static double sy_zeta(i64 n, double theta){
+  i64 exact = (n < (1 << 20)) ? n : (1 << 20);
+  double sum = 0.0;
+  for (i64 i = 1;i <= exact;i++){
+    sum += pow((double) i, -theta);
+  }
+  if (n > exact){
+    sum += (pow(n + 0.5, 1.0 - theta) - pow(exact + 0.5, 1.0 - theta)) / (1.0 - theta);
+  }
+  return sum;
+}
+
+// a count or size with an optional K, M or G suffix
+static i32 sy_size(const char* s, i64* v){
+  char* end;
+  *v = strtoul(s, &end, 0);
+  switch (*end){
+  case 'K': case 'k':
+    *v <<= 10;
+    end++;
+    break;
+  case 'M': case 'm':
+    *v <<= 20;
+    end++;
+    break;
+  case 'G': case 'g':
+    *v <<= 30;
+    end++;
+    break;
+  }
+  return end != s && *end == '\0';
+}
+
+static const char* sy_kinds[] = { "seq", "stride", "random", "zipf", "chase", 0 };
+
+synth_gen::synth_gen(){
+  ns = 0;
+  left = 0;
+  rng = 0;
+}
+
+synth_gen::~synth_gen(){
+}
+
+i32 synth_gen::parse_stream(synth_stream* sp, char* spec, i64 base, i32 num){
+  char* save;
+  char* f = strtok_r(spec, ":", &save);
+  i64 size = 64 << 20, stride = 64, seed = num + 1, v;
+  i32 k;
+
+  for (k = 0;sy_kinds[k] != 0 && strcmp(f, sy_kinds[k]) != 0;k++);
+  if (sy_kinds[k] == 0){
+    fprintf(stderr, "Unknown access pattern %s\n", f);
+    return 0;
+  }
+  memset(sp, 0, sizeof(synth_stream));
+  sp->kind = k;
+  sp->n = 1 << 20;
+  sp->base = base;
+  sp->theta = 0.99;
+
+  while ((f = strtok_r(0, ":", &save)) != 0){
+    char* val = strchr(f, '=');
+    if (val == 0){
+      fprintf(stderr, "Expected key=value, found %s\n", f);
+      return 0;
+    }
+    *val++ = '\0';
+    if (strcmp(f, "theta") == 0){
+      sp->theta = atof(val);
+      continue;
+    }
+    if (strcmp(f, "base") == 0){
+      sp->base = strtoul(val, 0, 16);
+      continue;
+    }
+    if (sy_size(val, &v) == 0){
+      fprintf(stderr, "Invalid value %s for %s\n", val, f);
+      return 0;
+    }
+    if (strcmp(f, "n") == 0){
+      sp->n = v;
+    }else if (strcmp(f, "size") == 0){
+      size = v;
+    }else if (strcmp(f, "stride") == 0){
+      stride = v;
+    }else if (strcmp(f, "w") == 0){
+      sp->wpct = v;
+    }else if (strcmp(f, "z") == 0){
+      sp->zpct = v;
+    }else if (strcmp(f, "seed") == 0){
+      seed = v;
+    }else{
+      fprintf(stderr, "Unknown key %s\n", f);
+      return 0;
+    }
+  }
+
+  sp->words = size >> 3;
+  sp->step = stride >> 3;
+  if (sp->words == 0 || sp->step == 0 || (stride & 7) != 0 || sp->step > sp->words ||
+      sp->wpct > 100 || sp->zpct > 100 || sp->theta <= 0.0 || sp->theta == 1.0 ||
+      (k == SY_CHASE && sp->words / sp->step < 2)){
+    fprintf(stderr, "Invalid %s stream: %lu B footprint, %lu B stride\n", sy_kinds[k], size, stride);
+    return 0;
+  }
+  sp->rng = sy_mix(seed) | 1;
+  return 1;
+}
+
+// tables and constants of the stream's pattern
+void synth_gen::setup(synth_stream* sp){
+  if (sp->kind == SY_ZIPF){
+    sp->zeta2 = 1.0 + pow(0.5, sp->theta);
+    sp->zetan = sy_zeta(sp->words, sp->theta);
+    sp->alpha = 1.0 / (1.0 - sp->theta);
+    sp->eta = (1.0 - pow(2.0 / sp->words, 1.0 - sp->theta)) / (1.0 - sp->zeta2 / sp->zetan);
+    sp->scatter = (0x9E3779B97F4A7C15UL % sp->words) | 1;
+    while (sy_gcd(sp->scatter, sp->words) != 1){
+      sp->scatter += 2;
+    }
+  }else if (sp->kind == SY_CHASE){
+    sp->nodes = sp->words / sp->step;
+    sp->bits = 64 - __builtin_clzl(sp->nodes - 1);
+    for (i32 i = 0;i < 3;i++){
+      sp->keys[i] = sy_next(&(sp->rng)) | 1;
+    }
+    sp->pos = ~0UL;
+    chase_next(sp);
+  }
+}
+
+// xor, odd multiplies and right xorshifts, each invertible modulo 2^bits
+inline i64 synth_gen::perm(synth_stream* sp, i64 x){
+  i64 mask = (sp->bits == 64) ? ~0UL : (1UL << sp->bits) - 1;
+  i32 h = (sp->bits + 1) >> 1;
+  x = (x ^ sp->keys[0]) & mask;
+  x = (x * sp->keys[1]) & mask;
+  x ^= x >> h;
+  x = (x * sp->keys[2]) & mask;
+  x ^= x >> h;
+  return x;
+}
+
+// move to the next node of the cycle
+inline void synth_gen::chase_next(synth_stream* sp){
+  do {
+    sp->pos++;
+    sp->node = perm(sp, sp->pos);
+  } while (sp->node >= sp->nodes);
+}
+
+i32 synth_gen::parse(const char* spec){
+  char buf[1024];
+  char* save;
+  i64 base = 0;
+
+  snprintf(buf, sizeof(buf), "%s", spec);
+  ns = 0;
+  left = 0;
+  for (char* f = strtok_r(buf, ",", &save);f != 0;f = strtok_r(0, ",", &save)){
+    if (ns == SYNTH_MAX_STREAMS){
+      fprintf(stderr, "At most %u access streams\n", SYNTH_MAX_STREAMS);
+      return 0;
+    }
+    synth_stream* sp = &(s[ns]);
+    if (parse_stream(sp, f, base, ns) == 0){
+      return 0;
+    }
+    setup(sp);
+    base = sp->base + (sp->words << 2);
+    left += sp->n;
+    ns++;
+  }
+  if (ns == 0){
+    fprintf(stderr, "Empty access pattern\n");
+    return 0;
+  }
+  rng = s[0].rng ^ 0xD1B54A32D192ED03UL;
+  return 1;
+}
+
+// word of the stream's next access
+inline i64 synth_gen::word(synth_stream* sp){
+  i64 w;
+
+  switch (sp->kind){
+  case SY_SEQ:
+    w = sp->pos;
+    sp->pos = (sp->pos + 1 == sp->words) ? 0 : sp->pos + 1;
+    return w;
+  case SY_STRIDE:
+    w = sp->pos;
+    sp->pos += sp->step;
+    if (sp->pos >= sp->words){
+      // start over one word further on, so every word is visited
+      sp->pos = (w % sp->step + 1) % sp->step;
+    }
+    return w;
+  case SY_RANDOM:
+    return sy_below(&(sp->rng), sp->words);
+  case SY_ZIPF:
+    {
+      double u = sy_unit(&(sp->rng));
+      double uz = u * sp->zetan;
+      i64 r;
+      if (uz < 1.0){
+	r = 0;
+      }else if (uz < sp->zeta2){
+	r = 1;
+      }else{
+	r = (i64) (sp->words * pow(sp->eta * u - sp->eta + 1.0, sp->alpha));
+	r = (r >= sp->words) ? sp->words - 1 : r;
+      }
+      return (i64) (((unsigned __int128) r * sp->scatter) % sp->words);
+    }
+  default:
+    w = sp->node * sp->step;
+    chase_next(sp);
+    return w;
+  }
+}
+
+i32 synth_gen::fill(trace_rec* out, i32 max){
+  i32 n = (left < max) ? left : max;
+
+  for (i32 i = 0;i < n;i++){
+    synth_stream* sp = s;
+    if (ns > 1){
+      i64 t = sy_below(&rng, left);
+      while (t >= sp->n){
+	t -= sp->n;
+	sp++;
+      }
+    }
+    sp->n--;
+    left--;
+
+    i64 addr = sp->base + (word(sp) << 2);
+    out[i].op = (sp->wpct != 0 && sy_below(&(sp->rng), 100) < sp->wpct) ? TR_WRITE : TR_READ;
+    out[i].pad = 0;
+    out[i].addr = addr;
+    if (sp->kind == SY_CHASE){
+      out[i].value = sp->base + ((sp->node * sp->step) << 2);
+    }else{
+      out[i].value = sy_value(addr, sp->zpct);
+    }
+  }
+  return n;
+}
+
+i64 synth_gen::total(){
+  i64 n = 0;
+  for (i32 i = 0;i < ns;i++){
+    n += s[i].n;
+  }
+  return n;
+}
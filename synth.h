@@ -0,0 +1,82 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include "utils.h"
+#include "trace.h"
+
+// synthetic accesses, generated in place of trace files. A spec is one or
+// more streams separated by commas, each kind[:key=value...]:
+//   seq     the words of the footprint in order, wrapping around
+//   stride  one word every stride bytes, wrapping around
+//   random  uniformly distributed words
+//   zipf    Zipf distributed words with skew theta, the hot ones scattered
+//           over the footprint
+//   chase   a pointer chase around one pseudo-random cycle through all
+//           stride byte nodes; a node's first word holds the next one's
+//           address
+// keys: n accesses (1M), size of the footprint in bytes (64M), stride (64),
+// theta (0.99), w percent writes (0), z percent zero words (0), base hex
+// address (streams follow each other from 0) and seed. Counts and sizes
+// take K, M and G suffixes. Words are 8 bytes, 4 address units apart as in
+// the traces.
+//
+// Streams are interleaved at random, in proportion to the accesses each
+// has left. A word's value is a hash of its address, so reads always find
+// what writes left there, and a spec and seed give the same accesses on
+// every run.
+
+#define SYNTH_MAX_STREAMS 16
+
+#define SY_SEQ 0
+#define SY_STRIDE 1
+#define SY_RANDOM 2
+#define SY_ZIPF 3
+#define SY_CHASE 4
+
+typedef struct synth_stream_t {
+  i32 kind;
+  i64 n; // accesses left
+  i64 words; // footprint
+  i64 base; // address of the first word
+  i64 step; // stride in words
+  i32 wpct;
+  i32 zpct;
+  i64 rng;
+  i64 pos; // next word of seq and stride, position in the chase's cycle
+  // zipf: ranks are drawn as in Gray et al., SIGMOD 1994, and scattered
+  // by a multiplier prime to words
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+  double zeta2;
+  i64 scatter;
+  // chase: the cycle visits node perm(0), perm(1), ... where perm is a
+  // keyed bijection on bits-bit numbers, skipping those past the last node
+  i64 node;
+  i64 nodes;
+  i32 bits;
+  i64 keys[3];
+} synth_stream;
+
+class synth_gen {
+  synth_stream s[SYNTH_MAX_STREAMS];
+  i32 ns;
+  i64 left;
+  i64 rng;
+  i32 parse_stream(synth_stream* sp, char* spec, i64 base, i32 num);
+  void setup(synth_stream* sp);
+  inline i64 perm(synth_stream* sp, i64 x);
+  inline void chase_next(synth_stream* sp);
+  inline i64 word(synth_stream* sp);
+ public:
+  synth_gen();
+  ~synth_gen();
+  // 0, with a message, if spec is not valid
+  i32 parse(const char* spec);
+  // up to max accesses into out, 0 once all have been made
+  i32 fill(trace_rec* out, i32 max);
+  i64 total();
+};
+
+#endif /* SYNTH_H */
@@ -1,17 +1,37 @@
 #include "tcache.h"
 #include <cstring>
+#include <assert.h>
+#include "simd.h"
+
+// move n words of a line, from word soff of src to word doff of dst; a
+// tag-only line is one mask with a bit per word
+template <i32 DATA>
+static inline void line_move(i64* dst, i32 doff, const i64* src, i32 soff, i32 n){
+  if (DATA){
+    memcpy(dst + doff, src + soff, n * sizeof(i64));
+  }else{
+    i64 m = (n == 64) ? ~0UL : ((1UL << n) - 1);
+    dst[0] = (dst[0] & ~(m << doff)) | (((src[0] >> soff) & m) << doff);
+  }
+}
+
+template <i32 DATA, class OBS>
+OBS tcache_t<DATA, OBS>::idle;
 
-#ifdef REFILL
-void tcache::set_trace(char* trace){
-  char fname[256];
-  appname = (char *)malloc(256 * sizeof(char));
-  strcpy(appname, trace);  
-  sprintf(fname, "%s_l2trace0.log", appname);
-  l2trace = fopen(fname, "w");
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_observer(OBS* op, i32 id){
+  obs = op;
+  lid = id;
+  obs->attach(id, name, nsets, bshift);
 }
-#endif
 
-tcache::tcache(i32 ns, i32 bs, i32 as, i32 ofs){
+template <i32 DATA, class OBS>
+i32 tcache_t<DATA, OBS>::block_shift(i32 bs, i32 ofs){
+  return log2(bs) - ofs;
+}
+
+template <i32 DATA, class OBS>
+tcache_t<DATA, OBS>::tcache_t(i32 ns, i32 bs, i32 as, i32 ofs){
   /* initialize cache parameters */
   sets = new cache_set[ns];
   nsets = ns;
@@ -21,461 +41,465 @@ tcache::tcache(i32 ns, i32 bs, i32 as, i32 ofs){
   imask = ns-1;
   oshift = 2;
   bmask = (bs >> 3) - 1;
-  l2trace = 0;
+  obs = &idle;
+  lid = 0;
 
   ishift = log2(ns);
-  bshift = log2(bs) - ofs;
-  amask = -1 << bshift;
+  bshift = block_shift(bs, ofs);
+  amask = ~0UL << bshift;
+
+  policy = POL_LRU;
+  rstate = 0x9E3779B97F4A7C15UL;
 
   // initialize pointer to L2 as zero
   next_level = 0;
+  prev_level = 0;
+  mem = 0;
+  map = 0;
   /* initialize statisitic counters */
   accs = 0;
   hits = 0;
   misses = 0;
   writebacks = 0;
   allocs = 0;
- 
-#ifdef LINETRACK
-  mcount = (i32*)calloc(nsets, sizeof(i32));
-  acount = (i32*)calloc(nsets, sizeof(i32));
-#endif
+  bwused = 0;
+  refills = zrefills = zwritebacks = zsaved = 0;
+
+  /* tags, data pointers and LRU ages for all sets live in arrays, set by set */
+  assert(assoc <= MAX_ASSOC);
+  i64* tags = new i64[nsets * assoc]();
+  i64** values = new i64*[nsets * assoc];
+  lru_age* ages = new lru_age[nsets * assoc];
+
+  /* block data lives in one arena, laid out by set and then way */
+  i32 words = DATA ? bvals : 1;
+  assert(DATA || bvals <= 64);
+  data = (i64*) arena_alloc((i64) nsets * assoc * words * sizeof(i64));
+  for (i32 i=0;i<nsets * assoc;i++){
+    values[i] = data + ((i64) i * words);
+  }
 
   for (i32 i=0;i<nsets;i++){
     /* distribute data blocks to cache sets */
-    sets[i].blks = new cache_block[assoc];
+    sets[i].tags = tags + (i * assoc);
+    sets[i].value = values + (i * assoc);
+    sets[i].valid = 0;
+    sets[i].dirty = 0;
     /* initialize LRU info */ 
-    item* node = new item();
-    node->val = 0;
-    sets[i].lru = node;
-    for (i32 j=1;j<assoc;j++){
-      node->next = new item();
-      node->next->val = j;
-      node = node->next;
-    }
+    sets[i].age = ages + (i * assoc);
+    lru_init(sets[i].age, assoc);
   }
 }
 
-void tcache::clearstats(){
+// lines handed over between levels of one size point into each other's
+// arenas, so the levels of a hierarchy go together
+template <i32 DATA, class OBS>
+tcache_t<DATA, OBS>::~tcache_t(){
+  delete[] sets[0].tags;
+  delete[] sets[0].value;
+  delete[] sets[0].age;
+  arena_free(data, (i64) nsets * assoc * (DATA ? bvals : 1) * sizeof(i64));
+  delete[] sets;
+}
+
+// way holding tag in the set, or -1 on a miss; if a tag were ever present
+// twice the highest way wins, as the old full scan did
+template <i32 DATA, class OBS>
+int tcache_t<DATA, OBS>::lookup(cache_set* set, i64 tag){
+  i64 m = simd_match64(set->tags, assoc, tag) & set->valid;
+  return (m == 0) ? -1 : (63 - __builtin_clzl(m));
+}
+
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::clearstats(){
    accs = 0;
    hits = 0;
    misses = 0;
    bwused = 0;
    writebacks = 0;
    allocs = 0;
+   refills = zrefills = zwritebacks = zsaved = 0;
+   obs->clearstats(lid);
+}
+
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::reg_stats(stat_registry* r){
+  r->add(name, "accs", &accs);
+  r->add(name, "hits", &hits);
+  r->add(name, "misses", &misses);
+  r->add(name, "writebacks", &writebacks);
+  r->add(name, "allocs", &allocs);
+  r->add(name, "bwused", &bwused);
+  r->add(name, "refills", &refills);
+  r->add(name, "zrefills", &zrefills);
+  r->add(name, "zwritebacks", &zwritebacks);
+  r->add(name, "zsaved", &zsaved);
+}
 
-#ifdef LINETRACK 
-   for(int i=0;i<nsets;i++){
-     mcount[i] = acount[i] = 0;
-   }
-#endif
+// 1 if every word of the line is zero
+template <i32 DATA, class OBS>
+i32 tcache_t<DATA, OBS>::line_zero(const i64* line){
+  return DATA ? simd_all_zero(line, bvals) : (line[0] == 0);
 }
 
-void tcache::writeback(cache_block* bp, i32 addr){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::writeback(cache_set* set, i32 way, i64 addr){
   i32 zero = 0;
+  i64* value = set->value[way];
+  i32 dirty = (set->dirty >> way) & 1;
+  // before a same-size next level takes the buffer
+  i32 allzero = line_zero(value);
+
+  zwritebacks += allzero;
+  obs->writeback(lid, addr, value, DATA ? bvals : 0);
 
   // L1 cache
   if (next_level != 0){
-    next_level->copy(addr, bp);
+    i32 nbvals = next_level->bvals;
+    if (bvals == nbvals){
+      // same line size, the next level takes this buffer over
+      next_level->copy(addr, value, 0, bvals, dirty, &(set->value[way]));
+    }else if (bvals < nbvals){
+      next_level->copy(addr, value, 0, bvals, dirty);
+    }else{
+      // split the line over the smaller lines of the next level
+      for (i32 i=0;i<bvals;i+=nbvals){
+	next_level->copy(addr + (i<<oshift), value, i, nbvals, dirty);
+      }
+    }
     bwused += bsize;
   }
 
-  // update maps on eviction
-  if (map != 0 && bp->dirty == 1){
-    for (i32 i=0;i<bvals;i++){
-      if (bp->value[i] != 0){
-	zero = 1;
-	break;
-      }
+  // update maps on eviction; a line a level above holds nonzero words of
+  // is not zero, the map would hide them once they come back down
+  if (map != 0 && dirty == 1){
+    zero = !allzero;
+    if (zero == 0 && map->get_enabled() && prev_level != 0 && prev_level->holds_nonzero(addr & amask, bvals)){
+      zero = 1;
     }
     if (zero == 0){ // all zeros
       map->update_block(addr, 0);
+      obs->map_update(addr, 0);
+      zsaved += (mem != 0) ? bsize : 0;
     }
   }
 
   if (mem != 0 && (zero == 1 || map == 0)){
-    for (i32 i=0;i<bvals;i++){
-      mem->write((addr & amask) + (i<<oshift), bp->value[i]);
-#ifdef TEST
-      if (addr == 0){
-	printf("WB (%X): Writing mem addr (%X), data(%llX)\n", addr, ((addr&amask)+(i<<oshift)), bp->value[i]);
-      }
-#endif
+    if (DATA){
+      mem->write_block(addr & amask, value, bvals);
+    }else{
+      mem->write_bits(addr & amask, value[0], bvals);
     }
     bwused += bsize;
   }
 
-  bp->dirty = 0;
+  set->dirty &= ~(1UL << way);
   writebacks++;
 }
 
-void tcache::allocate(i32 addr){
-  i32 tag, index, hit, hitway, wbaddr;
-  cache_block* bp;
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::allocate(i64 addr){
+  i32 index, hit, hitway;
+  i64 tag, wbaddr;
+  cache_set* set;
+  int way;
 
   index = (addr >> bshift) & imask;
   tag = (addr >> (bshift + ishift));
-  hitway = sets[index].lru->val;
-  hit = 0;
-  for(i32 i=0;i<assoc;i++){
-    bp = &(sets[index].blks[i]);
-    if ((bp->tag == tag) && (bp->valid == 1)){
-      hit = 1;
-      hitway = i;
-    }
-  }
-  bp = &(sets[index].blks[hitway]);
+  set = &(sets[index]);
+  way = lookup(set, tag);
+  hit = (way >= 0);
+  hitway = hit ? way : victim(set);
 
   hits+=hit;
   accs++;
   misses+=(1-hit);
 
-#ifdef TEST
-  if (addr == 0){
-    printf("%s allocate, set(%X), addr(%X)\n", name, index, addr);
-  }
-#endif
-
   // if block is valid and dirty, write it back
   if (hit == 0){
-#ifdef LINETRACK
-    if (((index%512) == 0) && (strcmp(name, "L2") == 0)){
-      printf("ALLOC: address(%08X), tag(%X), w0(%X), w1(%X)\n", addr, tag, sets[index].blks[0].tag, sets[index].blks[1].tag);
-    }
-#endif
-    if (bp->valid == 1 && bp->dirty == 1){
-      wbaddr = ((bp->tag) << (ishift+bshift)) + (index<<(bshift));
-      this->writeback(bp, wbaddr);
-    }
-
-    if (bp->value == 0){
-      bp->value = new i64[bvals];
-      if (bp->value <= 0){
-	printf("FATAL: calloc ran out of memory!\n");
-	exit(1);
+    if ((set->valid >> hitway) & 1){
+      wbaddr = ((set->tags[hitway]) << (ishift+bshift)) + (index<<(bshift));
+      obs->evict(lid, index, wbaddr, (set->dirty >> hitway) & 1);
+      if ((set->dirty >> hitway) & 1){
+	this->writeback(set, hitway, wbaddr);
       }
     }
 
-    bp->tag = tag;
-    bp->valid = 1;
-    bp->dirty = 0;
-    for (i32 i=0;i<bvals;i++){
-      bp->value[i] = 0;
-    }
+
+    set->tags[hitway] = tag;
+    set->valid |= (1UL << hitway);
+    set->dirty &= ~(1UL << hitway);
+    memset(set->value[hitway], 0, (DATA ? bvals : 1) * sizeof(i64));
   } // otherwise just update LRU info
 
-  update_lru(&(sets[index]), hitway);
+  update_lru(set, hitway, hit);
   allocs++;
 }
 
-void tcache::touch(i32 addr){
-  i32 tag, index, hit, hitway;
-  cache_block* bp;
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::touch(i64 addr){
+  i32 index;
+  i64 tag;
+  int way;
 
   index = (addr >> bshift) & imask;
   tag = (addr >> (bshift + ishift));
-  hitway = sets[index].lru->val;
-
-  hit = 0;
-  for(i32 i=0;i<assoc;i++){
-    bp = &(sets[index].blks[i]);
-    if ((bp->tag == tag) && (bp->valid == 1)){
-      hit = 1;
-      hitway = i;
-    }
+  way = lookup(&(sets[index]), tag);
+
+  if (way >= 0){
+    update_lru(&(sets[index]), way, 1);
   }
+}
 
-  if (hit == 1){
-    update_lru(&(sets[index]), hitway);
+template <i32 DATA, class OBS>
+i32 tcache_t<DATA, OBS>::holds_nonzero(i64 addr, i32 n){
+  i32 step = (n < bvals) ? n : bvals;
+
+  for (i32 i = 0;i < n;i += step){
+    i64 a = addr + ((i64) i << oshift);
+    cache_set* set = &(sets[(a >> bshift) & imask]);
+    int way = lookup(set, a >> (bshift + ishift));
+    if (way >= 0){
+      i32 off = (a >> oshift) & bmask;
+      if (DATA){
+	for (i32 j = 0;j < step;j++){
+	  if (set->value[way][off + j] != 0){
+	    return 1;
+	  }
+	}
+      }else{
+	i64 m = (step == 64) ? ~0UL : ((1UL << step) - 1);
+	if ((set->value[way][0] >> off) & m){
+	  return 1;
+	}
+      }
+    }
   }
+  return (prev_level != 0) ? prev_level->holds_nonzero(addr, n) : 0;
 }
 
-void tcache::copy(i32 addr, cache_block* op){
-  i32 tag, index, hitway, wbaddr, hit;
-  cache_block* bp;
+// write n words of a line evicted from the level above into this level;
+// a line smaller than ours is merged into the rest of our line. A whole
+// line whose buffer the caller passes in owner is moved, not copied: the
+// buffers are exchanged and the caller gets back our victim's, which it
+// is about to refill.
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::copy(i64 addr, i64* op, i32 ofs, i32 n, i32 dirty, i64** owner){
+  i32 index, hitway, hit, off;
+  i64 tag, wbaddr;
+  cache_set* set;
+  i64* bp;
+  int way;
 
   index = (addr >> bshift) & imask;
   tag = (addr >> (bshift + ishift));
-  hitway = sets[index].lru->val;
-  hit = 0;
-  for(i32 i=0;i<assoc;i++){
-    bp = &(sets[index].blks[i]);
-    if ((bp->tag == tag) && (bp->valid == 1)){
-      hit = 1;
-      hitway = i;
-    }
-  }
-  bp = &(sets[index].blks[hitway]);
+  set = &(sets[index]);
+  way = lookup(set, tag);
+  hit = (way >= 0);
+  hitway = hit ? way : victim(set);
 
   // if block is valid and dirty, write it back
-  if ((hit == 0) && (bp->valid == 1) && (bp->dirty == 1)){
-    wbaddr = ((bp->tag)<<(ishift+bshift)) + (index<<bshift);
-    this->writeback(bp, wbaddr);
-  }
-
-  if (bp->value == 0){
-    bp->value = (i64*) calloc(bvals, sizeof(i64));
-    if (bp->value <= 0){
-      printf("FATAL: calloc ran out of memory!\n");
-      exit(1);
+  if ((hit == 0) && ((set->valid >> hitway) & 1)){
+    wbaddr = ((set->tags[hitway])<<(ishift+bshift)) + (index<<bshift);
+    obs->evict(lid, index, wbaddr, (set->dirty >> hitway) & 1);
+    if ((set->dirty >> hitway) & 1){
+      this->writeback(set, hitway, wbaddr);
     }
   }
 
-  bp->tag = tag;
-  bp->valid = op->valid;
-  bp->dirty = op->dirty;
-  
-#ifdef TEST
-  if (addr == 0){ //(strcmp(name, "L2") == 0){
-    printf("%s (%u, %u) WB to addr (%X-%X): ", name, index, hitway, addr, addr+64);
-  }
-#endif
-  for (i32 i=0;i<bvals;i++){
-#ifdef L2TRACE
-    if (op->value[i] > 0ULL){
-      fprintf(l2trace, "%llx\n", op->value[i]);
-      if (lcnt++ > LMAX){
-	char fname[256];
-	sprintf(fname, "%s_l2trace%u.log", appname, ++fcnt);
-	fprintf(stderr, "Filled trace with %lu values, closing trace and opening new trace: %s\n", lcnt, fname);
-	fclose(l2trace);
-	l2trace = fopen(fname, "w");
-	lcnt = 0;
-      }
+  if (n < bvals){
+    // fetch the rest of the line before merging the partial line into it
+    if (hit == 0){
+      this->refill(set, hitway, addr);
     }
-#endif
-    bp->value[i] = op->value[i];
-#ifdef TEST
-   if (addr == 0){ //(strcmp(name, "L2") == 0){  //if (strcmp(name, "L2") == 0){
-     printf("%llX,", op->value[i]);
-   }
-#endif
+    off = (addr >> oshift) & bmask;
+    set->dirty |= ((i64) dirty << hitway);
+  }else{
+    off = 0;
+    set->dirty = (set->dirty & ~(1UL << hitway)) | ((i64) dirty << hitway);
+  }
+  if (owner != 0 && n == bvals){
+    *owner = set->value[hitway];
+    set->value[hitway] = op;
   }
-#ifdef TEST
-  if (addr == 0){ //(strcmp(name, "L2") == 0){ //if (strcmp(name, "L2") == 0){
-    printf("\n");
+  bp = set->value[hitway];
+
+  set->tags[hitway] = tag;
+  set->valid |= (1UL << hitway);
+
+  if (bp != op){
+    line_move<DATA>(bp, off, op, ofs, n);
   }
-#endif
 
-  update_lru(&(sets[index]), hitway);
+  update_lru(set, hitway, hit);
 }
 
-void tcache::refill(cache_block* bp, i32 addr){
-  i32 i, index, tag;
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::refill(cache_set* set, i32 way, i64 addr){
+  i64 tag;
+  i64* bp;
   tag = (addr >> (bshift + ishift)); 
-  index = (addr >> bshift) & imask;
   
-  bp->tag = tag;
-  bp->valid = 1;
-  bp->dirty = 0;
-  if (bp->value == 0){
-    bp->value = (i64*) calloc(bvals, sizeof(i64));
-    if (bp->value == 0){
-      printf("FATAL: calloc ran out of memory!\n");
-      exit(1);
-    }
-  }
-
-#ifdef TEST
-  if (strcmp(name, "L1") == 0 && addr == 0){
-    printf("refill called on %s, addr(%X-%X), %u\n", name, addr, addr+64, bvals);
-  }
-#endif
+  set->tags[way] = tag;
+  set->valid |= (1UL << way);
+  set->dirty &= ~(1UL << way);
+  bp = set->value[way];
 
   if (next_level != 0){
-    for (i32 i=0;i<bvals;i++){
-      bp->value[i] = next_level->read((addr&amask)+(i<<oshift), i);
-      /*if (strcmp(name, "L1") == 0  && addr == 0){
-	printf("%X-%llX,", (addr&amask)+(i<<oshift), bp->value[i]);
-	}*/
+    // a line larger than the next level's spans several of its lines,
+    // each of them is one access there
+    i32 n = (bvals < next_level->bvals) ? bvals : next_level->bvals;
+    for (i32 i=0;i<bvals;i+=n){
+      next_level->read_block((addr&amask)+(i<<oshift), bp, i, n);
     }
-    /*if (strcmp(name, "L1") == 0  && addr == 0){
-      printf("\n");
-      }*/
-    next_level->accs -= (bvals-1);
-    next_level->hits -= (bvals-1);
     bwused += bsize;
+    obs->refill(lid, addr, bp, DATA ? bvals : 0, 0);
   }
   else if (mem != 0){
     //printf("sets(%u), bsize(%u) - Refill from memory - addr(%08X), index(%u), tag(%X)\n", nsets, bsize, addr, index, tag);
     //exit(1);
 
-#ifdef LOG
-    fprintf(tlog, "m\n");
-#endif
-
-    for (i=0;i<bvals;i++){
-      i64 value = mem->read((addr & amask) + (i<<oshift));
-#ifdef REFILL
-      if (value > 0ULL){
-	fprintf(l2trace, "%lx\n", value);
-	if (lcnt++ > LMAX){
-	  char fname[256];
-	  sprintf(fname, "%s_l2trace%u.log", appname, ++fcnt);
-	  fprintf(stderr, "Filled trace with %u values, closing trace and opening new trace: %s\n", lcnt, fname);
-	  fclose(l2trace);
-	  l2trace = fopen(fname, "w");
-	  lcnt = 0;
-	}
+    if (map != 0 && map->nonzero(addr) == 0){
+      // the zero line written back last was dropped, memory's copy is
+      // stale; lines of another size than ours get here for blocks the
+      // map holds as zero, when split or merged
+      memset(bp, 0, (DATA ? bvals : 1) * sizeof(i64));
+    }else{
+      if (DATA){
+	mem->read_block(addr & amask, bp, bvals);
+      }else{
+	bp[0] = mem->read_bits(addr & amask, bvals);
       }
-#endif
-      bp->value[i] = value; //mem->read((addr & amask) + (i<<oshift));
-      //printf("REFILL (%X): Reading mem addr (%X), data(%llX)\n", addr, ((addr&amask)+(i<<oshift)), bp->value[i]);
+      bwused += bsize;
     }
-    bwused += bsize;
+    obs->refill(lid, addr, bp, DATA ? bvals : 0, 1);
   }
+  refills++;
+  zrefills += line_zero(bp);
   //printf("block size: %d, index: %d, addr: %X, bmask: %X\n", (bsize), (addr>>bshift)&(bmask), addr, bmask);
 }
 
-i64 tcache::read(i32 addr, i32 refill){
+// look up the line holding addr, filling it on a miss, and count one
+// access; hits are reported unless refill is set
+template <i32 DATA, class OBS>
+i64* tcache_t<DATA, OBS>::fetch(i64 addr, i32 refill){
   i32 index = (addr >> bshift) & imask;
-  i32 tag = (addr >> (bshift + ishift));  
+  i64 tag = (addr >> (bshift + ishift));  
+  cache_set* set = &(sets[index]);
   i32 hit = 0;
   i32 hitway = 0;
-  i32 zero = 0;
-  i32 wbaddr;
-  cache_block* block;
+  i64 wbaddr;
+  i64* block;
 
   // check tags
-  for(i32 i=0;i<assoc;i++){
-    if ((sets[index].blks[i].tag == tag) && (sets[index].blks[i].valid == 1)){
-      hit = 1;
-      hitway = i;      
-    }
+  int way = lookup(set, tag);
+  if (way >= 0){
+    hit = 1;
+    hitway = way;
   }
 
-#ifdef LINETRACK
-  acount[index]++;
-#endif
-
   // update bookkeeping
   if (hit == 1){
     hits++;
-    block = &(sets[index].blks[hitway]);
-
-#ifdef LOG
+    block = set->value[hitway];
     if (refill == 0){
-      fprintf(tlog, "%s\n", name);
+      obs->hit(lid, index, addr);
     }
-#endif
-
-#ifdef TEST
-    if (addr == 0){
-      printf("%s Read hit(%u,%u), addr(%X), data(%llX)\n", name, index, hitway, addr, block->value[((addr>>oshift)&bmask)]);
-      fflush(stdout);
-    }   
-#endif
-
   }else{
     misses++;    
-    hitway = sets[index].lru->val;
-#ifdef LINETRACK
-    mcount[index]++;
-    if (((index%512) == 0) && (strcmp(name, "L2") == 0)){
-      printf("address(%08X), tag(%X), w0(%X), w1(%X)\n", addr, tag, sets[index].blks[0].tag, sets[index].blks[1].tag);
-    }
-#endif
-    block = &(sets[index].blks[hitway]);
+    hitway = victim(set);
+    obs->miss(lid, index, addr);
     //printf("miss to index: %d on tag: %x, replaced %d\n", index, tag, hitway);
-    if (block->valid == 1 && block->dirty == 1){
-      // lock line in next level
-      if (next_level != 0){
-	next_level->touch(addr);
+    if ((set->valid >> hitway) & 1){
+      wbaddr = ((set->tags[hitway])<<(ishift+bshift)) + (index<<bshift);
+      obs->evict(lid, index, wbaddr, (set->dirty >> hitway) & 1);
+      if ((set->dirty >> hitway) & 1){
+	// lock line in next level
+	if (next_level != 0){
+	  next_level->touch(addr);
+	}
+	this->writeback(set, hitway, wbaddr);
       }
-      wbaddr = ((block->tag)<<(ishift+bshift)) + (index<<bshift);
-      this->writeback(block, wbaddr);
     }
-    this->refill(block, addr);
-#ifdef TEST
-    if (addr == 0){
-      printf("%s Read miss(%u,%u), addr(%X), data(%llX)\n", name, index, hitway, addr, block->value[((addr>>oshift)&bmask)]);
-      fflush(stdout);
-    }   
-#endif
+    this->refill(set, hitway, addr);
+    block = set->value[hitway];
   }
   
-  this->update_lru(&(sets[index]), hitway);
+  this->update_lru(set, hitway, hit);
   accs++;
 
   //printf("bsize(%u), sets(%u) - Access: read, addr(%X), index(%X), tag(%X), block(%X)\n", bsize, nsets, addr, index, tag, ((addr>>(oshift))&bmask));
 
-  return block->value[((addr>>oshift)&bmask)];
+  return block;
+}
+
+template <i32 DATA, class OBS>
+i64 tcache_t<DATA, OBS>::read(i64 addr, i32 refill){
+  i64* block = fetch(addr, refill);
+  i32 w = (addr>>oshift)&bmask;
+  return DATA ? block[w] : ((block[0] >> w) & 1);
+}
+
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::read_block(i64 addr, i64* out, i32 ofs, i32 n){
+  i64* block = fetch(addr, 0);
+  line_move<DATA>(out, ofs, block, ((addr>>oshift)&bmask), n);
 }
 
-void tcache::write(i32 addr, i64 data){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::write(i64 addr, i64 data){
   i32 index = (addr >> bshift) & imask;
-  i32 tag = (addr >> (bshift + ishift));  
+  i64 tag = (addr >> (bshift + ishift));  
+  cache_set* set = &(sets[index]);
   i32 hit = 0;
   i32 hitway = 0;
-  i32 zero = 0;
-  i32 wbaddr;
-  cache_block* block;
+  i64 wbaddr;
 
   //printf("cache write: address(%08X), data(%llX)\n", addr, data);
 
   // check tags
-  for(i32 i=0;i<assoc;i++){
-    block = &(sets[index].blks[i]);
-    if ((sets[index].blks[i].tag == tag) && (sets[index].blks[i].valid == 1)){
-      hit = 1;
-      hitway = i;
-    }
+  int way = lookup(set, tag);
+  if (way >= 0){
+    hit = 1;
+    hitway = way;
   }
 
-#ifdef LINETRACK
-  acount[index]++;
-#endif
-
   // update bookkeeping
   if (hit == 1){
     hits++;
-    block = &(sets[index].blks[hitway]);
-#ifdef LOG
-    fprintf(tlog, "%s\n", name);
-#endif
+    obs->hit(lid, index, addr);
   }else{
     misses++;    
-    hitway = sets[index].lru->val;
-#ifdef LINETRACK
-    mcount[index]++;      
-    if (((index%512) == 0) && (strcmp(name, "L2") == 0)){
-      printf("address(%08X), tag(%X), w0(%X), w1(%X)\n", addr, tag, sets[index].blks[0].tag, sets[index].blks[1].tag);
-    }
-#endif
-    block = &(sets[index].blks[hitway]);
+    hitway = victim(set);
+    obs->miss(lid, index, addr);
     //printf("miss to index: %d on tag: %x, replaced %d\n", index, tag, hitway);
-    if (block->valid == 1 && block->dirty == 1){
-      // lock line in next level
-      if (next_level != 0){
-	next_level->touch(addr);
+    if ((set->valid >> hitway) & 1){
+      wbaddr = ((set->tags[hitway])<<(ishift+bshift)) + (index<<bshift);
+      obs->evict(lid, index, wbaddr, (set->dirty >> hitway) & 1);
+      if ((set->dirty >> hitway) & 1){
+	// lock line in next level
+	if (next_level != 0){
+	  next_level->touch(addr);
+	}
+	this->writeback(set, hitway, wbaddr);
       }
-      wbaddr =  ((block->tag)<<(ishift+bshift)) + (index<<bshift);
-      this->writeback(block, wbaddr);
     }
-    this->refill(block, addr);
+    this->refill(set, hitway, addr);
   }
 
-#ifdef L2TRACE
-  if (data > 0){
-    fprintf(l2trace, "%llx\n", data);
-    if (lcnt++ > LMAX){      
-      char fname[256];
-      sprintf(fname, "%s_l2trace%u.log", appname, ++fcnt);
-      fprintf(stderr, "Filled trace with %lu values, closing trace and opening new trace: %s\n", lcnt, fname);
-      fclose(l2trace);
-      l2trace = fopen(fname, "w");
-      lcnt = 0;
-    }
+  if (DATA){
+    set->value[hitway][((addr>>oshift)&bmask)] = data;
+  }else{
+    i32 w = (addr>>oshift)&bmask;
+    set->value[hitway][0] = (set->value[hitway][0] & ~(1UL << w)) | ((i64)(data != 0) << w);
   }
-#endif
-  
-  block->value[((addr>>oshift)&bmask)] = data;
-  block->dirty = 1;
-  this->update_lru(&(sets[index]), hitway);
+  set->dirty |= (1UL << hitway);
+  this->update_lru(set, hitway, hit);
   accs++;
 }
 
-void tcache::stats(){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::stats(){
   i32 size = (nsets) * (assoc) * (bsize);
 
   printf("%s: %d KB cache:\n", name, size >> 10);
@@ -484,93 +508,100 @@ void tcache::stats(){
   if (mem != 0){
     printf("bandwidth used: %lu KB\n", (bwused >> 10));
   }
- 
-#ifdef LINETRACK 
+
+  i64 lines = 0, zlines = 0;
   for (i32 i=0;i<nsets;i++){
-    printf("Set %u, Accesses %u, Misses %u\n", i, acount[i], mcount[i]);
+    for (i32 w=0;w<assoc;w++){
+      if ((sets[i].valid >> w) & 1){
+	lines++;
+	zlines += line_zero(sets[i].value[w]);
+      }
+    }
   }
-#endif
+  printf("zero lines: %lu of %lu refills (%.2f%%), %lu of %lu writebacks (%.2f%%), %lu of %lu resident (%.2f%%)\n",
+	 zrefills, refills, refills ? 100.0 * zrefills / refills : 0.0,
+	 zwritebacks, writebacks, writebacks ? 100.0 * zwritebacks / writebacks : 0.0,
+	 zlines, lines, lines ? 100.0 * zlines / lines : 0.0);
+  if (map != 0 && mem != 0){
+    printf("memory writes saved by the map: %lu KB\n", zsaved >> 10);
+  }
+ 
+  obs->stats(lid);
 }
 
 
-void tcache::update_lru(cache_set * set, unsigned int hitway){
-  item * hitnode;
-  item * node = set->lru;
-  item * temp;
-
-  /*temp = set->lru;
-  printf("before: way %d referenced, (%d,", hitway, temp->val);
-  while (temp->next != 0){
-    temp = temp->next;
-    printf("%d,", temp->val);
+// LRU ages move on every reference, FIFO ages only when a line is filled
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::update_lru(cache_set * set, unsigned int hitway, i32 hit){
+  if (policy == POL_LRU || (policy == POL_FIFO && hit == 0)){
+    lru_touch(set->age, assoc, hitway);
   }
-  printf(")\n");*/
+}
 
-  if (node->next == 0){
-    // direct-mapped cache
-    return;
-  }
-  
-  if (node->val == hitway){
-    hitnode = node;
-    set->lru = node->next;
-    while (node->next != 0){
-      node = node->next;
-    }
-  }else{
-    while (node->next != 0){
-      if (node->next->val == hitway){
-	hitnode = node->next;
-	node->next = hitnode->next;
-      }else{
-	node = node->next;
-      }
-    }
-  }
-  node->next = hitnode;
-  hitnode->next = 0;
-
-  /*temp = set->lru;
-  printf("after: way %d referenced, (%d,", hitway, temp->val);
-  while (temp->next != 0){
-    temp = temp->next;
-    printf("%d,", temp->val);
+template <i32 DATA, class OBS>
+i32 tcache_t<DATA, OBS>::victim(cache_set * set){
+  if (policy == POL_RANDOM){
+    // xorshift, so runs stay reproducible
+    rstate ^= rstate << 13;
+    rstate ^= rstate >> 7;
+    rstate ^= rstate << 17;
+    return rstate % assoc;
   }
-  printf(")\n");*/
+  return lru_victim(set->age, assoc);
 }
 
-void tcache::set_mem(tmemory* sp){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_policy(i32 p){
+  policy = p;
+}
+
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_mem(tmemory* sp){
   mem = sp;
 }
 
-void tcache::set_map(mem_map* mp){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_map(mem_map* mp){
   map = mp;
 }
 
-void tcache::set_nl(tcache* cp){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_nl(tcache_t<DATA, OBS>* cp){
   next_level = cp;
+  cp->prev_level = this;
 }
 
-void tcache::set_name(char *cp){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_name(char *cp){
   name = cp;
 }
 
-void tcache::set_anum(i32 n){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_anum(i32 n){
   anum = n;
 }
 
-i64 tcache::get_accs(){
+template <i32 DATA, class OBS>
+i64 tcache_t<DATA, OBS>::get_accs(){
   return accs;
 }
 
-i64 tcache::get_hits(){
+template <i32 DATA, class OBS>
+i64 tcache_t<DATA, OBS>::get_hits(){
   return hits;
 }
 
-void tcache::set_accs(i64 num){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_accs(i64 num){
   accs = num;
 }
 
-void tcache::set_hits(i64 num){
+template <i32 DATA, class OBS>
+void tcache_t<DATA, OBS>::set_hits(i64 num){
   hits = num;
 }
+
+template class tcache_t<1>;
+template class tcache_t<0>;
+template class tcache_t<1, sim_observer>;
+template class tcache_t<0, sim_observer>;
@@ -4,13 +4,24 @@
 #include "utils.h"
 #include "memmap.h"
 #include "store.h"
+#include "observe.h"
 
-//#define LINETRACK 1
+// replacement policies
 
-// cache implementation
+#define POL_LRU 0
+#define POL_FIFO 1
+#define POL_RANDOM 2
 
-class tcache {
+// cache implementation; with DATA set every line holds its values, without
+// it a line holds only a mask of its nonzero words (lines of up to 64
+// words), which is all the map and bandwidth counters depend on. Hits,
+// misses, evictions, writebacks and refills are reported to an OBS, see
+// observe.h.
+
+template <i32 DATA, class OBS = no_observer>
+class tcache_t {
   cache_set* sets;
+  i64* data;
   i32 nsets;
   i32 bsize;
   i32 bvals;
@@ -20,50 +31,72 @@ class tcache {
   i32 ishift;
   i32 bshift;
   i32 oshift;
-  i32 amask;
+  i64 amask;
+  i32 policy;
+  i64 rstate;
   i64 accs;
   i64 hits;
   i64 misses;
   i64 writebacks;
   i64 allocs;
   i64 bwused;
+  // zero content: refills and dirty writebacks of all-zero lines, and
+  // memory writes the map made unnecessary
+  i64 refills;
+  i64 zrefills;
+  i64 zwritebacks;
+  i64 zsaved;
   i32 anum;
-  i32* acount;
-  i32* mcount;
-  tcache* next_level;
+  tcache_t* next_level;
+  tcache_t* prev_level;
   tmemory* mem;
   mem_map* map;
   char * name;
-#ifdef REFILL
-  FILE* l2trace;
-  char* appname;
-  int fcnt;
-  int lcnt;
-#endif
+  OBS* obs;
+  i32 lid; // level number reported to obs
+  static OBS idle; // observer of unbound caches
+  int lookup(cache_set* set, i64 tag);
+  i32 victim(cache_set* set);
+  i32 line_zero(const i64* line);
+  i64* fetch(i64 addr, i32 refill);
  public:
-  tcache(i32 ns, i32 bs, i32 as, i32 ofs);
-  i64 read(i32 addr, i32 refill);
-  void write(i32 addr, i64 data);
-  void writeback(cache_block* bp, i32 addr);
-  void refill(cache_block* bp, i32 addr);
+  tcache_t(i32 ns, i32 bs, i32 as, i32 ofs);
+  ~tcache_t();
+  // shift from an address to its block number
+  static i32 block_shift(i32 bs, i32 ofs);
+  i64 read(i64 addr, i32 refill);
+  // n words of the line holding addr into out from word ofs on, for a
+  // level above filling its line
+  void read_block(i64 addr, i64* out, i32 ofs, i32 n);
+  void write(i64 addr, i64 data);
+  void writeback(cache_set* set, i32 way, i64 addr);
+  void refill(cache_set* set, i32 way, i64 addr);
   void stats();
-  void update_lru(cache_set * lru, i32 hitway);
-  void copy(i32 addr, cache_block* op);
-  void allocate(i32 addr);
-  void touch(i32 addr);
+  void update_lru(cache_set * lru, i32 hitway, i32 hit);
+  void copy(i64 addr, i64* op, i32 ofs, i32 n, i32 dirty, i64** owner = 0);
+  void allocate(i64 addr);
+  void touch(i64 addr);
+  // 1 if this level or one above holds a nonzero word among the n words
+  // from addr, a line of a level below
+  i32 holds_nonzero(i64 addr, i32 n);
   void clearstats();
+  // access, miss, writeback, bandwidth and zero line counters as name.*
+  void reg_stats(stat_registry* r);
   void set_mem(tmemory* sp);
   void set_map(mem_map* mp);
-  void set_nl(tcache* cp);
+  void set_nl(tcache_t* cp);
   void set_name(char * cp);
+  void set_policy(i32 p);
   void set_anum(i32 n);
   i64 get_accs();
   i64 get_hits();
   void set_accs(i64 num);
   void set_hits(i64 num);
-#ifdef REFILL
-  void set_trace(char *);
-#endif
+  // report events to op as level id
+  void set_observer(OBS* op, i32 id);
 };
 
+typedef tcache_t<1> tcache;
+typedef tcache_t<0> tag_cache;
+
 #endif /* TCACHE_H */
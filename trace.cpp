@@ -0,0 +1,679 @@
+#include "trace.h"
+#include "synth.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// SWAR helpers: eight characters are classified and decoded at once
+
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+// high bit set in every byte strictly between m and n (bytes < 128 only)
+static inline i64 swar_between(i64 x, i64 m, i64 n){
+  i64 lo = x & (ONES * 127);
+  return ((ONES * (127 + n) - lo) & ~x & (lo + ONES * (127 - m))) & HIGHS;
+}
+
+// decode the run of up to 8 hex digits at p into *v, returns its length
+static inline i32 swar_hex8(const char* p, i64* v){
+  i64 x, d;
+  i32 n;
+  memcpy(&x, p, 8);
+
+  i64 hex = swar_between(x, '0' - 1, '9' + 1) | swar_between(x | (ONES * 0x20), 'a' - 1, 'f' + 1);
+  i64 non = ~hex & HIGHS;
+  n = (non == 0) ? 8 : (__builtin_ctzl(non) >> 3);
+  if (n == 0){
+    *v = 0;
+    return 0;
+  }
+
+  // digit values, letters have bit 6 set and need +9
+  d = (x & (ONES * 0x0F)) + ((x >> 6) & ONES) * 9;
+  // drop the bytes past the run and put the last digit in the low byte
+  d = __builtin_bswap64(d << ((8 - n) << 3));
+  d = (d & 0x00FF00FF00FF00FFUL) + (((d >> 8) & 0x00FF00FF00FF00FFUL) << 4);
+  d = (d & 0x0000FFFF0000FFFFUL) + (((d >> 16) & 0x0000FFFF0000FFFFUL) << 8);
+  d = (d & 0xFFFFFFFFUL) + ((d >> 32) << 16);
+  *v = d;
+  return n;
+}
+
+// hex number of up to 16 digits with an optional 0x, returns its length or 0
+static inline i32 parse_hex(const char* p, i64* v){
+  i32 pre = 0, n1, n2;
+  i64 hi, lo;
+
+  if (p[0] == '0' && (p[1] | 0x20) == 'x'){
+    pre = 2;
+  }
+  n1 = swar_hex8(p + pre, &hi);
+  if (n1 < 8){
+    *v = hi;
+    return (n1 == 0) ? 0 : pre + n1;
+  }
+  n2 = swar_hex8(p + pre + 8, &lo);
+  if (n2 == 8){
+    i64 more;
+    if (swar_hex8(p + pre + 16, &more) != 0){
+      return 0; // does not fit in 64 bits
+    }
+  }
+  *v = (n2 == 0) ? hi : ((hi << (n2 << 2)) | lo);
+  return pre + 8 + n2;
+}
+
+static inline const char* skip_blanks(const char* p){
+  while (*p == ' ' || *p == '\t'){
+    p++;
+  }
+  return p;
+}
+
+int trace_parse(const char* p, const char** end, trace_rec* r){
+  const char* q;
+  i64 addr, value;
+  i32 n;
+
+  q = skip_blanks(p);
+  if (*q == '\n' || (*q == '\r' && q[1] == '\n')){
+    *end = q + ((*q == '\r') ? 2 : 1);
+    return 0;
+  }
+
+  if (memcmp(q, "read", 4) == 0){
+    r->op = TR_READ;
+    q += 4;
+  }else if (memcmp(q, "write", 5) == 0){
+    r->op = TR_WRITE;
+    q += 5;
+  }else{
+    goto bad;
+  }
+  if (*q != ' ' && *q != '\t'){
+    goto bad;
+  }
+
+  q = skip_blanks(q);
+  n = parse_hex(q, &addr);
+  if (n == 0){
+    goto bad;
+  }
+  q += n;
+  if (*q != ' ' && *q != '\t'){
+    goto bad;
+  }
+
+  q = skip_blanks(q);
+  n = parse_hex(q, &value);
+  if (n == 0){
+    goto bad;
+  }
+  q = skip_blanks(q + n);
+  if (*q == '\r'){
+    q++;
+  }
+  if (*q != '\n'){
+    goto bad;
+  }
+
+  r->addr = addr;
+  r->value = value;
+  *end = q + 1;
+  return 1;
+
+ bad:
+  *end = (const char*) memchr(q, '\n', TEXT_BUF) + 1;
+  return -1;
+}
+
+trace_reader::trace_reader(){
+  in = 0;
+  compressed = 0;
+  fname[0] = 0;
+  memset(&st, 0, sizeof(trace_stats));
+  map = 0;
+  mapsize = 0;
+  recs = 0;
+  nrecs = 0;
+  pos = 0;
+  stream = 0;
+  v1 = 0;
+  // padded so the SWAR loads may run past the last line
+  tbuf = new char[TEXT_BUF + 64];
+  tlen = tpos = tend = 0;
+  lineno = 0;
+  teof = 0;
+}
+
+trace_reader::~trace_reader(){
+  close();
+  delete[] tbuf;
+}
+
+// version 2 traces, or version 1 ones with their 32-bit addresses
+i32 trace_reader::check_hdr(const trace_hdr* hdr){
+  if (hdr->version == TRACE_VERSION && hdr->recsize == sizeof(trace_rec)){
+    v1 = 0;
+    return 1;
+  }
+  if (hdr->version == 1 && hdr->recsize == sizeof(trace_rec_v1)){
+    v1 = 1;
+    return 1;
+  }
+  return 0;
+}
+
+i32 trace_reader::open_binary(int fd, i64 size){
+  trace_hdr* hdr;
+
+  map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED){
+    perror("mmap");
+    map = 0;
+    return 0;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  mapsize = size;
+
+  hdr = (trace_hdr*) map;
+  if (check_hdr(hdr) == 0){
+    fprintf(stderr, "Unsupported binary trace version %u, record size %u\n", hdr->version, hdr->recsize);
+    munmap(map, mapsize);
+    map = 0;
+    return 0;
+  }
+
+  recs = (const char*) map + sizeof(trace_hdr);
+  nrecs = (size - sizeof(trace_hdr)) / hdr->recsize;
+  if (hdr->count < (i64) nrecs){
+    nrecs = hdr->count;
+  }
+  pos = 0;
+  return 1;
+}
+
+i32 trace_reader::open_stream(){
+  trace_hdr hdr;
+
+  if (fread(&hdr, sizeof(trace_hdr), 1, in) != 1 || hdr.magic != TRACE_MAGIC ||
+      check_hdr(&hdr) == 0){
+    fprintf(stderr, "Invalid binary trace stream\n");
+    return 0;
+  }
+  stream = 1;
+  return 1;
+}
+
+i32 trace_reader::open(const char* file){
+  struct stat sb;
+  trace_hdr hdr;
+  int fd;
+  i32 z;
+
+  close();
+  snprintf(fname, sizeof(fname), "%s", file);
+  z = zpipe_type(file);
+  if (z != ZP_NONE){
+    in = zp.open(file, z);
+    if (in == 0){
+      return 0;
+    }
+    compressed = 1;
+    // the name without the compression suffix decides the format
+    i32 len = strlen(file) - ((z == ZP_GZIP) ? 3 : 4);
+    if (len >= 4 && strncmp(file + len - 4, ".trc", 4) == 0){
+      if (open_stream() == 0){
+	close();
+	return 0;
+      }
+    }
+    return 1;
+  }
+
+  fd = ::open(file, O_RDONLY);
+  if (fd < 0){
+    return 0;
+  }
+
+  // binary traces start with the magic number, anything else is text
+  if (fstat(fd, &sb) == 0 && sb.st_size >= (off_t) sizeof(trace_hdr) &&
+      pread(fd, &hdr, sizeof(trace_hdr), 0) == sizeof(trace_hdr) && hdr.magic == TRACE_MAGIC){
+    i32 ok = open_binary(fd, sb.st_size);
+    ::close(fd);
+    return ok;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  in = fdopen(fd, "r");
+  if (in == NULL){
+    ::close(fd);
+    return 0;
+  }
+  return 1;
+}
+
+void trace_reader::close(){
+  if (map != 0){
+    munmap(map, mapsize);
+    map = 0;
+  }
+  if (compressed){
+    zp.close();
+    compressed = 0;
+  }else if (in != 0){
+    fclose(in);
+  }
+  in = 0;
+  stream = 0;
+  recs = 0;
+  nrecs = 0;
+  pos = 0;
+  tlen = tpos = tend = 0;
+  lineno = 0;
+  teof = 0;
+}
+
+i32 trace_reader::is_binary(){
+  return (map != 0 || stream != 0);
+}
+
+i32 trace_reader::lends(){
+  return (map != 0 && v1 == 0);
+}
+
+i32 trace_reader::lend(const trace_rec** out, i32 max){
+  double t = wtime();
+  i32 n = (nrecs - pos < max) ? (nrecs - pos) : max;
+
+  *out = (const trace_rec*) recs + pos;
+  pos += n;
+  st.lines += n;
+  st.dtime += wtime() - t;
+  return n;
+}
+
+void* trace_reader::take_map(i64* size){
+  void* m = map;
+  *size = mapsize;
+  map = 0;
+  return m;
+}
+
+i32 trace_reader::failed(){
+  return (in != 0 && ferror(in)) || (compressed && zp.failed());
+}
+
+const trace_stats* trace_reader::get_stats(){
+  return &st;
+}
+
+void trace_reader::bad_line(const char* why){
+  if (st.bad < MAX_BAD_REPORTS){
+    fprintf(stderr, "%s:%lu: %s, line skipped\n", fname, lineno, why);
+  }else if (st.bad == MAX_BAD_REPORTS){
+    fprintf(stderr, "%s: further malformed lines not reported\n", fname);
+  }
+  st.bad++;
+}
+
+// slide the unparsed tail to the front and read until tbuf holds at
+// least one complete line, returns 0 at end of file
+i32 trace_reader::refill(){
+  i32 skipping = 0;
+  double t;
+
+  tlen -= tpos;
+  memmove(tbuf, tbuf + tpos, tlen);
+  tpos = 0;
+  tend = 0;
+
+  while (tend == 0){
+    if (teof){
+      if (tlen == 0 || skipping){
+	return 0;
+      }
+      tbuf[tlen++] = '\n'; // last line without a newline
+      tend = tlen;
+      break;
+    }
+    if (tlen == TEXT_BUF){
+      // a line longer than the whole buffer can't be an access
+      lineno++;
+      bad_line("line too long");
+      skipping = 1;
+      tlen = 0;
+    }
+
+    t = wtime();
+    i64 got = fread(tbuf + tlen, 1, TEXT_BUF - tlen, in);
+    st.iotime += wtime() - t;
+    if (got <= 0){
+      teof = 1;
+      continue;
+    }
+
+    char* nl = (char*) memrchr(tbuf + tlen, '\n', got);
+    tlen += got;
+    if (nl != 0){
+      tend = nl + 1 - tbuf;
+      if (skipping){
+	// drop the rest of the over-long line
+	tpos = (char*) memchr(tbuf, '\n', tlen) + 1 - tbuf;
+	skipping = 0;
+      }
+    }else if (skipping){
+      tlen = 0;
+    }
+  }
+
+  memset(tbuf + tlen, 0, 64);
+  return 1;
+}
+
+i32 trace_reader::fill_text(trace_rec* out, i32 max){
+  const char* e;
+  i32 n = 0;
+
+  while (n < max){
+    if (tpos >= tend){
+      if (in == 0 || refill() == 0){
+	break;
+      }
+      continue;
+    }
+
+    lineno++;
+    int r = trace_parse(tbuf + tpos, &e, &(out[n]));
+    if (r > 0){
+      n++;
+    }else if (r < 0){
+      bad_line("malformed trace line");
+    }
+    tpos = e - tbuf;
+  }
+  return n;
+}
+
+static void widen(trace_rec* out, const trace_rec_v1* in, i32 n){
+  for (i32 i = 0;i < n;i++){
+    trace_rec_v1 r = in[i];
+    out[i].op = r.op;
+    out[i].pad = 0;
+    out[i].addr = r.addr;
+    out[i].value = r.value;
+  }
+}
+
+i32 trace_reader::fill(trace_rec* out, i32 max){
+  double t = wtime();
+  i32 n;
+
+  if (map != 0){
+    n = (nrecs - pos < max) ? (nrecs - pos) : max;
+    if (v1){
+      widen(out, (const trace_rec_v1*) recs + pos, n);
+    }else{
+      memcpy(out, (const trace_rec*) recs + pos, n * sizeof(trace_rec));
+    }
+    pos += n;
+  }else if (stream != 0){
+    if (v1){
+      // the narrower records are read into the back of out and widened
+      // front to back, which never overtakes the unread ones
+      trace_rec_v1* in1 = (trace_rec_v1*) (out + max) - max;
+      n = fread(in1, sizeof(trace_rec_v1), max, in);
+      widen(out, in1, n);
+    }else{
+      n = fread(out, sizeof(trace_rec), max, in);
+    }
+  }else{
+    n = fill_text(out, max);
+  }
+
+  st.lines += n;
+  st.dtime += wtime() - t;
+  return n;
+}
+
+// in order of preference
+static const char* trace_exts[] = {
+  ".trc", ".trc.zst", ".trc.gz", ".log", ".log.zst", ".log.gz", 0
+};
+
+i32 trace_find(char* file, const char* dir, const char* app, i32 num){
+  for (i32 i = 0;trace_exts[i] != 0;i++){
+    sprintf(file, "%s/%s%d%s", dir, app, num, trace_exts[i]);
+    if (access(file, R_OK) == 0){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+i32 trace_convert(const char* infile, const char* outfile, i64* count){
+  trace_reader tr;
+  trace_rec* rp;
+  trace_hdr hdr;
+  FILE* out;
+  i32 n, ok = 1;
+
+  if (tr.open(infile) == 0){
+    perror(infile);
+    return 0;
+  }
+  out = fopen(outfile, "wb");
+  if (out == NULL){
+    perror(outfile);
+    return 0;
+  }
+
+  memset(&hdr, 0, sizeof(trace_hdr));
+  hdr.magic = TRACE_MAGIC;
+  hdr.version = TRACE_VERSION;
+  hdr.recsize = sizeof(trace_rec);
+  fwrite(&hdr, sizeof(trace_hdr), 1, out);
+
+  rp = new trace_rec[BATCH_RECS];
+  while (ok && (n = tr.fill(rp, BATCH_RECS)) > 0){
+    ok = (fwrite(rp, sizeof(trace_rec), n, out) == n);
+    hdr.count += n;
+  }
+  delete[] rp;
+  if (tr.failed()){
+    fprintf(stderr, "%s: read error, no output written\n", infile);
+    fclose(out);
+    unlink(outfile);
+    return 0;
+  }
+
+  // patch the record count into the header
+  if (ok){
+    ok = (fseek(out, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(trace_hdr), 1, out) == 1);
+  }
+  ok = (fclose(out) == 0) && ok;
+  if (!ok){
+    perror(outfile);
+    unlink(outfile);
+    return 0;
+  }
+  *count = hdr.count;
+  return 1;
+}
+
+void trace_prefetch(const char* file){
+  int fd = ::open(file, O_RDONLY);
+  if (fd >= 0){
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(fd);
+  }
+}
+
+trace_feeder::trace_feeder(const char* d, const char* a, i32 n, i32 nreaders){
+  ring = new batch_ring<trace_batch>(RING_SLOTS, nreaders);
+  thr = 0;
+  dir = d;
+  app = a;
+  nfiles = n;
+  gen = 0;
+  begun = 0;
+  memset(&st, 0, sizeof(trace_stats));
+}
+
+trace_feeder::trace_feeder(synth_gen* g, i32 nreaders){
+  ring = new batch_ring<trace_batch>(RING_SLOTS, nreaders);
+  thr = 0;
+  dir = app = 0;
+  nfiles = 0;
+  gen = g;
+  begun = 0;
+  memset(&st, 0, sizeof(trace_stats));
+}
+
+trace_feeder::~trace_feeder(){
+  join();
+  unmap(1);
+  delete ring;
+}
+
+// a slot to fill, its records in its own buffer
+trace_batch* trace_feeder::begin(){
+  trace_batch* bp = ring->produce_begin();
+  bp->n = 0;
+  bp->recs = bp->buf;
+  begun++;
+  unmap(0);
+  return bp;
+}
+
+// unmap the traces every reader is past: a slot is only handed out again
+// once all readers have released it, so when the batch begun now reuses
+// the slot of a trace's last batch, none of its batches is still read
+void trace_feeder::unmap(i32 all){
+  for (i32 i = 0;i < maps.size();){
+    if (all || begun >= maps[i].end + RING_SLOTS){
+      munmap(maps[i].addr, maps[i].size);
+      maps.erase(maps.begin() + i);
+    }else{
+      i++;
+    }
+  }
+}
+
+void trace_feeder::start(){
+  thr = new std::thread((gen != 0) ? &trace_feeder::run_synth : &trace_feeder::run, this);
+}
+
+// generated batches count as decoded lines, their time as decode time
+void trace_feeder::run_synth(){
+  fprintf(stderr, "Generating %lu synthetic accesses\n", gen->total());
+  for (;;){
+    trace_batch* bp = begin();
+    double t = wtime();
+    bp->n = gen->fill(bp->buf, BATCH_RECS);
+    st.dtime += wtime() - t;
+    if (bp->n == 0){
+      break;
+    }
+    st.lines += bp->n;
+    ring->produce_commit();
+  }
+  ring->finish();
+}
+
+void trace_feeder::run(){
+  trace_reader tr;
+  trace_batch* bp = 0;
+  char file[512];
+  i32 failed = 0;
+
+  for (i32 i = 0;i < nfiles;i++){
+    // start pulling in the next file while this one is decoded and simulated
+    if (i + 1 < nfiles && trace_find(file, dir, app, i + 1)){
+      trace_prefetch(file);
+    }
+
+    trace_find(file, dir, app, i);
+    fprintf(stderr, "Reading from file %s\n", file);
+    if (tr.open(file) == 0){
+      perror("Invalid file");
+      continue;
+    }
+
+    if (tr.lends()){
+      // whole batches are slices of the mapping, finish the one begun
+      if (bp != 0 && bp->n > 0){
+	ring->produce_commit();
+	bp = 0;
+      }
+      for (;;){
+	if (bp == 0){
+	  bp = begin();
+	}
+	i32 n = tr.lend(&(bp->recs), BATCH_RECS);
+	if (n == 0){
+	  bp->recs = bp->buf;
+	  break;
+	}
+	bp->n = n;
+	ring->produce_commit();
+	bp = 0;
+      }
+      trace_map m;
+      m.addr = tr.take_map(&(m.size));
+      m.end = begun;
+      maps.push_back(m);
+      continue;
+    }
+
+    // decode straight into the ring slots, batches may span files
+    for (;;){
+      if (bp == 0){
+	bp = begin();
+      }
+      i32 n = tr.fill(bp->buf + bp->n, BATCH_RECS - bp->n);
+      if (n == 0){
+	if (tr.failed()){
+	  fprintf(stderr, "%s: read error, the trace is cut short\n", file);
+	  failed++;
+	}
+	break;
+      }
+      bp->n += n;
+      if (bp->n == BATCH_RECS){
+	ring->produce_commit();
+	bp = 0;
+      }
+    }
+  }
+
+  if (bp != 0 && bp->n > 0){
+    ring->produce_commit();
+  }
+  st = *(tr.get_stats());
+  st.failed = failed;
+  ring->finish();
+}
+
+trace_batch* trace_feeder::next(i32 reader){
+  return ring->consume_begin(reader);
+}
+
+void trace_feeder::release(i32 reader){
+  ring->consume_commit(reader);
+}
+
+const trace_stats* trace_feeder::get_stats(){
+  return &st;
+}
+
+void trace_feeder::join(){
+  if (thr != 0){
+    thr->join();
+    delete thr;
+    thr = 0;
+  }
+}
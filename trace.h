@@ -0,0 +1,175 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <thread>
+#include <vector>
+#include "utils.h"
+#include "ring.h"
+#include "zpipe.h"
+
+// binary trace format: a fixed header followed by fixed-width records,
+// laid out so the records can be walked in place from an mmap'd file
+
+#define TRACE_MAGIC 0x52545343 // "CSTR"
+#define TRACE_VERSION 2
+
+#define TR_READ 0
+#define TR_WRITE 1
+
+typedef struct trace_hdr_t {
+  i32 magic;
+  i32 version;
+  i32 recsize;
+  i32 flags;
+  i64 count;
+} trace_hdr;
+
+typedef struct trace_rec_t {
+  i32 op;
+  i32 pad;
+  i64 addr;
+  i64 value;
+} trace_rec;
+
+// version 1 records, with 32-bit addresses; still read, widened on decode
+typedef struct trace_rec_v1_t {
+  i32 op;
+  i32 addr;
+  i64 value;
+} trace_rec_v1;
+
+// parse one text trace line starting at p; returns 1 for an access, 0 for
+// a blank line and -1 for a malformed line, and points *end past the
+// newline. The line must end in '\n' and the buffer must stay readable
+// for 16 bytes past it.
+int trace_parse(const char* p, const char** end, trace_rec* r);
+
+// decode counters, accumulated over all files a reader has opened
+
+typedef struct trace_stats_t {
+  i64 lines;
+  i64 bad;
+  double dtime; // time spent decoding, including I/O
+  double iotime;
+  i32 failed; // files that could not be read to their end
+} trace_stats;
+
+// reads one trace file, binary (mmap'd, zero-copy) or text (parsed);
+// .gz/.zst files are decompressed as a stream, and are binary when the
+// name ends in .trc.gz/.trc.zst
+
+#define TEXT_BUF (1 << 20)
+#define MAX_BAD_REPORTS 10
+
+class trace_reader {
+  FILE* in;
+  zpipe zp;
+  i32 compressed;
+  char fname[512];
+  trace_stats st;
+
+  // binary trace state
+  void* map;
+  i64 mapsize;
+  const char* recs;
+  i64 nrecs;
+  i64 pos;
+  i32 stream; // binary records read from a pipe
+  i32 v1; // records are trace_rec_v1
+
+  // text trace state: complete lines live in tbuf[tpos, tend)
+  char* tbuf;
+  i64 tlen;
+  i64 tpos;
+  i64 tend;
+  i64 lineno;
+  i32 teof;
+
+  i32 open_binary(int fd, i64 size);
+  i32 open_stream();
+  i32 check_hdr(const trace_hdr* hdr);
+  i32 refill();
+  i32 fill_text(trace_rec* out, i32 max);
+  void bad_line(const char* why);
+ public:
+  trace_reader();
+  ~trace_reader();
+  i32 open(const char* file);
+  void close();
+  i32 fill(trace_rec* out, i32 max);
+  // version 2 binary traces are handed out in place: points *out at up
+  // to max records of the mapping and returns how many
+  i32 lends();
+  i32 lend(const trace_rec** out, i32 max);
+  // give up the mapping, which close() then leaves mapped for the caller
+  // to unmap once nothing points into it
+  void* take_map(i64* size);
+  i32 is_binary();
+  // 1 if reading the file failed rather than reaching its end
+  i32 failed();
+  const trace_stats* get_stats();
+};
+
+// decoded records are handed from the decode thread to the simulation
+// loop in batches
+
+#define BATCH_RECS 4096
+#define RING_SLOTS 16
+
+// a batch's records are decoded into buf, or for version 2 binary traces
+// are a slice of the mapped file, which stays mapped until every reader
+// is past it
+typedef struct trace_batch_t {
+  i32 n;
+  const trace_rec* recs;
+  trace_rec buf[BATCH_RECS];
+} trace_batch;
+
+typedef struct trace_map_t {
+  void* addr;
+  i64 size;
+  i64 end; // batches begun once its last one was committed
+} trace_map;
+
+// decodes <dir>/<app><0..nfiles-1>, or generates synthetic accesses, on
+// its own thread into a batch ring shared read-only by nreaders
+// simulation threads
+
+class synth_gen;
+
+class trace_feeder {
+  batch_ring<trace_batch>* ring;
+  std::thread* thr;
+  const char* dir;
+  const char* app;
+  i32 nfiles;
+  synth_gen* gen;
+  trace_stats st;
+  std::vector<trace_map> maps; // lent traces some reader may still be in
+  i64 begun;
+  trace_batch* begin();
+  void unmap(i32 all);
+  void run();
+  void run_synth();
+ public:
+  trace_feeder(const char* dir, const char* app, i32 nfiles, i32 nreaders = 1);
+  trace_feeder(synth_gen* gen, i32 nreaders = 1);
+  ~trace_feeder();
+  void start();
+  trace_batch* next(i32 reader = 0);
+  void release(i32 reader = 0);
+  void join();
+  const trace_stats* get_stats();
+};
+
+// hint the kernel to start reading a trace file ahead of use
+void trace_prefetch(const char* file);
+
+// locate the trace file for <dir>/<app><num>, preferring binary traces
+i32 trace_find(char* file, const char* dir, const char* app, i32 num);
+
+// write a text trace as a binary trace and its number of records to
+// *count; returns 0 on failure, with no output file left behind
+i32 trace_convert(const char* infile, const char* outfile, i64* count);
+
+#endif /* TRACE_H */
@@ -0,0 +1,36 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// converts <dir>/<app><N>.log text traces into <dir>/<app><N>.trc binary traces
+
+int main(int argc, char** argv){
+  if (argc != 3){
+    printf("usage: %s (dir) filename\n", argv[0]);
+    return 1;
+  }
+
+  i32 fcnt = 0;
+  for (i32 i = 0;;i++){
+    char in[512], out[512];
+    sprintf(in, "%s/%s%d.log", argv[1], argv[2], i);
+    if (access(in, R_OK) != 0){
+      break;
+    }
+    sprintf(out, "%s/%s%d.trc", argv[1], argv[2], i);
+    i64 n;
+    if (trace_convert(in, out, &n) == 0){
+      return 1;
+    }
+    fprintf(stderr, "Converted %s to %s (%lu records)\n", in, out, n);
+    fcnt++;
+  }
+
+  if (fcnt == 0){
+    fprintf(stderr, "No valid trace files of name %s found\n", argv[2]);
+    return 1;
+  }
+  return 0;
+}
@@ -1,3 +1,8 @@
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "utils.h"
+
 unsigned int pow2(unsigned int v){
   if ((v > 0) && (v & (v - 1)) == 0){
     return 1;
@@ -5,3 +10,32 @@ unsigned int pow2(unsigned int v){
     return 0;
   }
 }
+
+// wall clock time in seconds
+double wtime(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+i64 peak_rss(){
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+void* arena_alloc(i64 bytes){
+  void* p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED){
+    perror("arena mmap");
+    exit(1);
+  }
+#ifdef HUGEPAGES
+  madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+  return p;
+}
+
+void arena_free(void* p, i64 bytes){
+  munmap(p, bytes);
+}
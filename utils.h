@@ -7,36 +7,65 @@
 typedef unsigned int i32;
 typedef unsigned long i64;
 
-#ifdef LOG
-extern FILE* tlog;
-#endif
-
-//#define TEST 1
-//#define L2TRACE 1
-#define REFILL
+//#define HUGEPAGES 1
 #define LMAX 1<<26
 
-// lru implementation
+// lru implementation: one age per way, 0 is the least recently used way
+// and n-1 the most recently used, initialized to the way number
+
+typedef unsigned char lru_age;  // cache sets (up to 256 ways)
+typedef unsigned short tlb_age; // set associative map tlbs
+
+template <class T>
+inline void lru_init(T* age, i32 n){
+  for (i32 i=0;i<n;i++){
+    age[i] = i;
+  }
+}
+
+// make hitway the most recently used way
+template <class T>
+inline void lru_touch(T* age, i32 n, i32 hitway){
+  T a = age[hitway];
+  for (i32 i=0;i<n;i++){
+    age[i] -= (age[i] > a);
+  }
+  age[hitway] = n - 1;
+}
 
-typedef struct llnode {
-   unsigned int val;
-   struct llnode * next;
-} item;
+// the least recently used way, found without branches
+template <class T>
+inline i32 lru_victim(const T* age, i32 n){
+  i32 v = 0;
+  for (i32 i=0;i<n;i++){
+    v |= i & -(i32)(age[i] == 0);
+  }
+  return v;
+}
 
 unsigned int pow2(unsigned int v);
+double wtime();
+// peak resident set size of the process in KB
+i64 peak_rss();
 
-typedef struct cache_blk_t
-{
-  i32 valid;
-  i32 dirty;
-  i32 tag;
-  i64 * value;
-} cache_block;
+// zero-filled, page-aligned memory for large simulator arrays
+void* arena_alloc(i64 bytes);
+void arena_free(void* p, i64 bytes);
+
+// cache sets are stored structure-of-arrays: the tags of all ways are
+// contiguous so one vector compare checks the whole set, and the valid
+// and dirty state are bitmasks over the ways (up to 64 ways); each way's
+// data pointer refers into its cache's block arena
+
+#define MAX_ASSOC 64
 
 typedef struct cache_set
 {
-  cache_block* blks;
-  item* lru;
+  i64* tags;
+  i64 valid;
+  i64 dirty;
+  i64** value;
+  lru_age* age;
 } cache_set;
 
 
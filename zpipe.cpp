@@ -0,0 +1,179 @@
+#include "zpipe.h"
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+
+i32 zpipe_type(const char* file){
+  i32 len = strlen(file);
+  if (len > 3 && strcmp(file + len - 3, ".gz") == 0){
+    return ZP_GZIP;
+  }
+  if (len > 4 && strcmp(file + len - 4, ".zst") == 0){
+    return ZP_ZSTD;
+  }
+  return ZP_NONE;
+}
+
+// write a whole buffer to the pipe, returns 0 once the reader has gone away
+static i32 write_all(int fd, const char* buf, i64 n){
+  while (n > 0){
+    ssize_t w = write(fd, buf, n);
+    if (w <= 0){
+      return 0;
+    }
+    buf += w;
+    n -= w;
+  }
+  return 1;
+}
+
+zpipe::zpipe(){
+  thr = 0;
+  src = -1;
+  fds[0] = fds[1] = -1;
+  in = 0;
+  type = ZP_NONE;
+  err = 0;
+}
+
+zpipe::~zpipe(){
+  close();
+}
+
+FILE* zpipe::open(const char* file, i32 t){
+  close();
+  if (t == ZP_NONE){
+    return 0;
+  }
+#ifndef ZSTD
+  if (t == ZP_ZSTD){
+    fprintf(stderr, "%s: built without zstd support (make ZSTD=1)\n", file);
+    return 0;
+  }
+#endif
+
+  src = ::open(file, O_RDONLY);
+  if (src < 0){
+    return 0;
+  }
+  posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (pipe(fds) != 0){
+    perror("pipe");
+    ::close(src);
+    src = -1;
+    return 0;
+  }
+  fcntl(fds[1], F_SETPIPE_SZ, ZP_CHUNK);
+  in = fdopen(fds[0], "r");
+  if (in == NULL){
+    perror("fdopen");
+    ::close(fds[0]);
+    ::close(fds[1]);
+    ::close(src);
+    fds[0] = fds[1] = src = -1;
+    return 0;
+  }
+  type = t;
+  err = 0;
+  thr = new std::thread(&zpipe::run, this);
+  return in;
+}
+
+void zpipe::close(){
+  // closing the read end first unblocks a helper that is still writing
+  if (in != 0){
+    fclose(in);
+    in = 0;
+    fds[0] = -1;
+  }
+  if (thr != 0){
+    thr->join();
+    delete thr;
+    thr = 0;
+  }
+}
+
+i32 zpipe::failed(){
+  return err;
+}
+
+void zpipe::run(){
+  sigset_t set;
+  char* out = new char[ZP_CHUNK];
+
+  // an early close by the reader must show up as EPIPE, not kill the process
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, 0);
+
+  if (type == ZP_GZIP){
+    gzFile gz = gzdopen(src, "rb");
+    gzbuffer(gz, ZP_CHUNK);
+    int n, e;
+    while ((n = gzread(gz, out, ZP_CHUNK)) > 0){
+      if (write_all(fds[1], out, n) == 0){
+	break;
+      }
+    }
+    // a stream cut short ends like any other, with the error left behind
+    const char* msg = gzerror(gz, &e);
+    if (n < 0 || (n == 0 && e != Z_OK)){
+      fprintf(stderr, "gzip stream error: %s\n", msg);
+      err = 1;
+    }
+    gzclose(gz);
+  }
+#ifdef ZSTD
+  else if (type == ZP_ZSTD){
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    i64 isize = ZSTD_DStreamInSize();
+    char* in = new char[isize];
+    ssize_t n;
+    size_t r = 0; // nonzero while a frame is unfinished
+    i32 ok = 1;
+    ZSTD_initDStream(zs);
+    while (ok && (n = read(src, in, isize)) > 0){
+      ZSTD_inBuffer ib = { in, (size_t) n, 0 };
+      i32 more = 1;
+      // a full output buffer may leave decoded data behind, so keep
+      // draining until the input is consumed and the output is short
+      while (more){
+	ZSTD_outBuffer ob = { out, ZP_CHUNK, 0 };
+	r = ZSTD_decompressStream(zs, &ob, &ib);
+	if (ZSTD_isError(r)){
+	  fprintf(stderr, "zstd stream error: %s\n", ZSTD_getErrorName(r));
+	  err = 1;
+	  ok = 0;
+	  break;
+	}
+	if (write_all(fds[1], out, ob.pos) == 0){
+	  ok = 0;
+	  break;
+	}
+	more = (ib.pos < ib.size) || (ob.pos == ob.size);
+      }
+    }
+    // a reader gone away is no error, a read error or a last frame
+    // cut short is
+    if (ok && (n < 0 || r != 0)){
+      fprintf(stderr, "zstd stream error: %s\n", (n < 0) ? strerror(errno) : "truncated frame");
+      err = 1;
+    }
+    delete[] in;
+    ZSTD_freeDStream(zs);
+    ::close(src);
+  }
+#endif
+
+  src = -1;
+  ::close(fds[1]);
+  fds[1] = -1;
+  delete[] out;
+}
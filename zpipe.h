@@ -0,0 +1,38 @@
+#ifndef ZPIPE_H
+#define ZPIPE_H
+
+#include <thread>
+#include <atomic>
+#include "utils.h"
+
+// streaming decompression: a helper thread inflates a compressed file
+// into a pipe, and the reader consumes the other end like a plain file
+
+#define ZP_NONE 0
+#define ZP_GZIP 1
+#define ZP_ZSTD 2
+
+#define ZP_CHUNK (256 << 10)
+
+class zpipe {
+  std::thread* thr;
+  int src;
+  int fds[2];
+  FILE* in;
+  i32 type;
+  std::atomic<i32> err; // the stream was corrupt or cut short
+  void run();
+ public:
+  zpipe();
+  ~zpipe();
+  FILE* open(const char* file, i32 type);
+  void close();
+  // 1 if the file could not be decompressed to its end; set before the
+  // pipe reads as EOF
+  i32 failed();
+};
+
+// compression type from the file extension
+i32 zpipe_type(const char* file);
+
+#endif /* ZPIPE_H */